@@ -0,0 +1,456 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+#include "etna/etna_core.hpp"
+#include "etna/scene.hpp"
+
+// Headless render benchmark: every scenario builds a synthetic scene and
+// renders a fixed number of frames into an offscreen RenderTarget, then
+// prints one JSON object per scenario and node count.
+//
+// usage: etna_bench [--frames N] [--max-nodes N] [--scenario name]
+//                   [--elide-state 0|1] [--indirect 0|1] [--gpu-cull 0|1]
+
+using namespace etna;
+using Clock = std::chrono::steady_clock;
+
+constexpr VkExtent2D TARGET_EXTENT{1280, 720};
+constexpr uint32_t NODE_COUNTS[]{1'000, 10'000, 100'000, 1'000'000};
+constexpr uint32_t HIERARCHY_DEPTH{32};
+constexpr uint32_t SPARSE_ANIMATED_CHAINS{16};
+constexpr uint32_t INSTANCES_PER_NODE{64};
+constexpr uint32_t RAY_GRID{64};
+
+struct BenchScene {
+	Scene scene;
+	CameraNode camera;
+	std::vector<SceneNode> animated;
+};
+
+struct Scenario {
+	const char* name;
+	std::function<void(BenchScene&, uint32_t nodeCount)> build;
+};
+
+struct FrameStats {
+	double cpuMs{0};
+	double cpuP99Ms{0};
+	double gpuMs{-1};
+	// the world matrix update, part of cpuMs
+	double transformMs{0};
+	// counters of the last frame, the scenes are the same every frame
+	RenderStats renderStats{};
+};
+
+static Vec3 gridPosition(uint32_t i, uint32_t count) {
+	const uint32_t side =
+		std::max(1u, static_cast<uint32_t>(std::cbrt(static_cast<float>(count))));
+
+	const float spacing{1.5f};
+
+	return {
+		static_cast<float>(i % side) * spacing,
+		static_cast<float>((i / side) % side) * spacing,
+		-static_cast<float>(i / (side * side)) * spacing - 5.f,
+	};
+}
+
+static std::vector<MaterialHandle> createMaterials(uint32_t count) {
+	std::vector<MaterialHandle> materials;
+
+	const Color palette[]{RED, GREEN, BLUE, PURPLE, CELESTE, YELLOW};
+
+	for (uint32_t i{0}; i < count; i++) {
+		const Color color = palette[i % std::size(palette)];
+
+		materials.push_back(i % 2 ? engine::createColorMaterial(color)
+								  : engine::createGridMaterial({.color = color}));
+	}
+
+	return materials;
+}
+
+static void addMeshes(BenchScene& bench,
+					  uint32_t count,
+					  const std::vector<MaterialHandle>& materials,
+					  uint32_t instanceCount = 1) {
+	const MeshHandle meshes[]{engine::getCube(), engine::getSphere()};
+
+	for (uint32_t i{0}; i < count; i++) {
+		bench.scene.createMeshNode({
+			.name = "node" + std::to_string(i),
+			.mesh = meshes[i % std::size(meshes)],
+			.transform = {.position = gridPosition(i, count), .scale = Vec3(0.5)},
+			.material = materials[i % materials.size()],
+			.instanceCount = instanceCount,
+		});
+	}
+}
+
+// chains of HIERARCHY_DEPTH nodes, the roots of the first animatedChains
+// rotating every frame
+static void addChains(BenchScene& bench, uint32_t count, uint32_t animatedChains) {
+	const auto materials = createMaterials(4);
+	const uint32_t chains = std::max(1u, count / HIERARCHY_DEPTH);
+
+	for (uint32_t c{0}; c < chains; c++) {
+		SceneNode parent = bench.scene.addNode(
+			scene::createRoot("chain" + std::to_string(c)),
+			{.position = gridPosition(c, chains)});
+
+		if (c < animatedChains) {
+			bench.animated.push_back(parent);
+		}
+
+		for (uint32_t d{0}; d < HIERARCHY_DEPTH; d++) {
+			parent = parent->createMeshNode({
+				.name = "link" + std::to_string(d),
+				.mesh = engine::getCube(),
+				.transform = {.position = {0, 0.2f, 0}, .scale = Vec3(0.9)},
+				.material = materials[d % materials.size()],
+			});
+		}
+	}
+}
+
+static const Scenario SCENARIOS[]{
+	{
+		"flat",
+		[](BenchScene& bench, uint32_t count) {
+			addMeshes(bench, count, createMaterials(1));
+		},
+	},
+	{
+		"materials",
+		[](BenchScene& bench, uint32_t count) {
+			addMeshes(bench, count, createMaterials(16));
+		},
+	},
+	{
+		"instanced",
+		[](BenchScene& bench, uint32_t count) {
+			addMeshes(bench, std::max(1u, count / INSTANCES_PER_NODE),
+					  createMaterials(4), INSTANCES_PER_NODE);
+		},
+	},
+	{
+		"lights",
+		[](BenchScene& bench, uint32_t count) {
+			for (uint32_t i{0}; i < Scene::MAX_LIGHTS; i++) {
+				bench.scene.createLightNode({
+					.name = "light" + std::to_string(i),
+					.direction = Vec3{0, -1, -1}.normalize(),
+					.intensity = 1.f / Scene::MAX_LIGHTS,
+				});
+			}
+
+			addMeshes(bench, count, createMaterials(4));
+		},
+	},
+	{
+		// chains of HIERARCHY_DEPTH nodes whose roots rotate every frame, so
+		// each frame propagates transforms through the whole hierarchy
+		"hierarchy",
+		[](BenchScene& bench, uint32_t count) {
+			addChains(bench, count, ~0u);
+		},
+	},
+	{
+		// the same scene with only a few chains moving: transformMs should
+		// follow the moved nodes, not the scene size
+		"hierarchy-sparse",
+		[](BenchScene& bench, uint32_t count) {
+			addChains(bench, count, SPARSE_ANIMATED_CHAINS);
+		},
+	},
+};
+
+// resident and peak resident set size in MiB, from /proc/self/status
+static void readMemory(double& rssMb, double& peakMb) {
+	std::ifstream status("/proc/self/status");
+	std::string line;
+
+	rssMb = peakMb = 0;
+
+	while (std::getline(status, line)) {
+		if (line.rfind("VmRSS:", 0) == 0) {
+			rssMb = std::stod(line.substr(6)) / 1024.0;
+		} else if (line.rfind("VmHWM:", 0) == 0) {
+			peakMb = std::stod(line.substr(6)) / 1024.0;
+		}
+	}
+}
+
+static FrameStats renderFrames(BenchScene& bench,
+							   Renderer& renderer,
+							   const RenderTarget& target,
+							   uint32_t frames,
+							   const SceneRenderInfo& renderInfo) {
+	VkDevice device = engine::getDevice().getDevice();
+
+	VkPhysicalDeviceProperties properties{};
+	vkGetPhysicalDeviceProperties(engine::getDevice().getPhysicalDevice(),
+								  &properties);
+
+	// one begin/end timestamp pair per frame, read back once at the end
+	const VkQueryPoolCreateInfo queryInfo{
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = frames * 2,
+	};
+
+	VkQueryPool queryPool{VK_NULL_HANDLE};
+
+	if (vkCreateQueryPool(device, &queryInfo, nullptr, &queryPool) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create query pool");
+	}
+
+	engine::immediateSubmit([&](ignis::Command& cmd) {
+		vkCmdResetQueryPool(cmd.getHandle(), queryPool, 0, frames * 2);
+	});
+
+	std::vector<double> cpuTimes;
+	double transformTotal{0};
+	RenderStats renderStats{};
+
+	for (uint32_t frame{0}; frame < frames; frame++) {
+		const auto start = Clock::now();
+
+		for (const SceneNode& node : bench.animated) {
+			node->rotate(0.01f, 0.005f, 0);
+		}
+
+		// render would do it too, timed apart here
+		const auto transformStart = Clock::now();
+
+		bench.scene.updateTransforms();
+
+		transformTotal += std::chrono::duration<double, std::milli>(
+							  Clock::now() - transformStart)
+							  .count();
+
+		renderer.beginFrame(target);
+
+		vkCmdWriteTimestamp(renderer.getCommand().getHandle(),
+							VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, frame * 2);
+
+		bench.scene.render(renderer, bench.camera, renderInfo);
+
+		vkCmdWriteTimestamp(renderer.getCommand().getHandle(),
+							VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool,
+							frame * 2 + 1);
+
+		renderer.endFrame();
+
+		renderStats = renderer.getStats();
+
+		cpuTimes.push_back(
+			std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+	}
+
+	engine::getDevice().waitIdle();
+
+	FrameStats stats{
+		.transformMs = transformTotal / frames,
+		.renderStats = renderStats,
+	};
+
+	std::vector<uint64_t> timestamps(frames * 2);
+
+	if (vkGetQueryPoolResults(device, queryPool, 0, frames * 2,
+							  timestamps.size() * sizeof(uint64_t),
+							  timestamps.data(), sizeof(uint64_t),
+							  VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+		double gpuTotal{0};
+
+		for (uint32_t frame{0}; frame < frames; frame++) {
+			gpuTotal += static_cast<double>(timestamps[frame * 2 + 1] -
+											timestamps[frame * 2]) *
+						properties.limits.timestampPeriod / 1e6;
+		}
+
+		stats.gpuMs = gpuTotal / frames;
+	}
+
+	vkDestroyQueryPool(device, queryPool, nullptr);
+
+	for (double time : cpuTimes) {
+		stats.cpuMs += time / frames;
+	}
+
+	std::sort(cpuTimes.begin(), cpuTimes.end());
+	stats.cpuP99Ms = cpuTimes[std::min<size_t>(frames - 1, frames * 99 / 100)];
+
+	return stats;
+}
+
+// a batch of rays from the camera across the view, in microseconds per ray;
+// the first batch builds the triangle BVHs, so only the second is timed
+static double castRays(const BenchScene& bench) {
+	std::vector<Ray> rays;
+	std::vector<RaycastHit> hits(RAY_GRID * RAY_GRID);
+
+	for (uint32_t i{0}; i < RAY_GRID * RAY_GRID; i++) {
+		const float x = static_cast<float>(i % RAY_GRID) / (RAY_GRID - 1) - 0.5f;
+		const float y = static_cast<float>(i / RAY_GRID) / (RAY_GRID - 1) - 0.5f;
+
+		rays.push_back({.origin = {0, 0, 10}, .direction = {x, y, -1}});
+	}
+
+	bench.scene.raycast(rays, hits);
+
+	const auto start = Clock::now();
+
+	bench.scene.raycast(rays, hits);
+
+	return std::chrono::duration<double, std::micro>(Clock::now() - start).count() /
+		   rays.size();
+}
+
+#ifdef ETNA_STATS
+
+// uniform updates go through the staging ring rather than updateBuffer; the
+// bufferUpdates the bench reports must still count them
+static bool checkUploadCounters() {
+	const float block[4]{};
+
+	const engine::TransferCounters before = engine::getTransferCounters();
+
+	const engine::UniformHandle handle = engine::allocateUniform(sizeof(block));
+	engine::updateUniform(handle, block, sizeof(block));
+	engine::freeUniform(handle);
+
+	const engine::TransferCounters after = engine::getTransferCounters();
+
+	return after.bufferUpdates == before.bufferUpdates + 1 &&
+		   after.bufferUpdateBytes == before.bufferUpdateBytes + sizeof(block);
+}
+
+#endif
+
+static void runScenario(const Scenario& scenario,
+						uint32_t nodeCount,
+						uint32_t frames,
+						Renderer& renderer,
+						const RenderTarget& target,
+						const SceneRenderInfo& renderInfo) {
+	const auto buildStart = Clock::now();
+
+	BenchScene bench;
+
+	bench.camera = bench.scene.createCameraNode({
+		.name = "camera",
+		.transform = {.position = {0, 0, 10}},
+	});
+
+	scenario.build(bench, nodeCount);
+
+	// let the mesh and instance uploads land before measuring
+	engine::waitFor(engine::flushUploads());
+
+	const double buildMs =
+		std::chrono::duration<double, std::milli>(Clock::now() - buildStart).count();
+
+	const FrameStats stats =
+		renderFrames(bench, renderer, target, frames, renderInfo);
+
+	const double raycastUsPerRay = castRays(bench);
+
+	double rssMb{0}, peakMb{0};
+	readMemory(rssMb, peakMb);
+
+	const RenderStats& renderStats = stats.renderStats;
+
+	const double cpuUsPerDraw =
+		renderStats.drawCalls ? stats.cpuMs * 1000.0 / renderStats.drawCalls : 0;
+
+	const uint32_t skippedBinds = renderStats.skippedPipelineBinds +
+								  renderStats.skippedIndexBufferBinds +
+								  renderStats.skippedStateSets;
+
+	std::printf("{\"scenario\": \"%s\", \"nodes\": %u, \"frames\": %u, "
+				"\"buildMs\": %.3f, \"cpuFrameMs\": %.4f, \"cpuFrameP99Ms\": "
+				"%.4f, \"gpuFrameMs\": %.4f, \"transformMs\": %.4f, "
+				"\"drawCalls\": %u, \"cpuUsPerDraw\": "
+				"%.4f, \"triangles\": %llu, \"pipelineBinds\": %u, "
+				"\"skippedBinds\": %u, \"pushConstantBytes\": %llu, "
+				"\"culledDraws\": %u, \"bufferUpdates\": %u, "
+				"\"raycastUsPerRay\": %.4f, \"rssMb\": %.1f, \"peakRssMb\": %.1f}\n",
+				scenario.name, nodeCount, frames, buildMs, stats.cpuMs,
+				stats.cpuP99Ms, stats.gpuMs, stats.transformMs,
+				renderStats.drawCalls, cpuUsPerDraw,
+				static_cast<unsigned long long>(renderStats.triangles),
+				renderStats.pipelineBinds, skippedBinds,
+				static_cast<unsigned long long>(renderStats.pushConstantBytes),
+				renderStats.culledDraws, renderStats.bufferUpdates, raycastUsPerRay,
+				rssMb, peakMb);
+
+	std::fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+	uint32_t frames{100};
+	uint32_t maxNodes{1'000'000};
+	std::string only;
+	bool elideState{true};
+	bool indirect{false};
+	bool gpuCulling{false};
+
+	for (int i{1}; i + 1 < argc; i += 2) {
+		if (!std::strcmp(argv[i], "--frames")) {
+			frames = std::max(1ul, std::stoul(argv[i + 1]));
+		} else if (!std::strcmp(argv[i], "--max-nodes")) {
+			maxNodes = std::stoul(argv[i + 1]);
+		} else if (!std::strcmp(argv[i], "--scenario")) {
+			only = argv[i + 1];
+		} else if (!std::strcmp(argv[i], "--elide-state")) {
+			elideState = std::stoul(argv[i + 1]) != 0;
+		} else if (!std::strcmp(argv[i], "--indirect")) {
+			indirect = std::stoul(argv[i + 1]) != 0;
+		} else if (!std::strcmp(argv[i], "--gpu-cull")) {
+			gpuCulling = std::stoul(argv[i + 1]) != 0;
+		}
+	}
+
+	engine::init({
+		.appName = "Etna Bench",
+		.headless = true,
+	});
+
+	engine::initDefaultMaterials();
+
+#ifdef ETNA_STATS
+	if (!checkUploadCounters()) {
+		std::fprintf(stderr, "uniform updates are missing from bufferUpdates\n");
+		return 1;
+	}
+#endif
+
+	const RenderTarget target({.extent = TARGET_EXTENT});
+
+	Renderer renderer({
+		.elideRedundantState = elideState,
+		.gpuCulling = gpuCulling,
+	});
+
+	for (const Scenario& scenario : SCENARIOS) {
+		if (!only.empty() && only != scenario.name) {
+			continue;
+		}
+
+		for (uint32_t nodeCount : NODE_COUNTS) {
+			if (nodeCount <= maxNodes) {
+				runScenario(scenario, nodeCount, frames, renderer, target,
+							{.indirect = indirect});
+			}
+		}
+	}
+
+	return 0;
+}
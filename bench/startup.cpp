@@ -0,0 +1,80 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include "etna/etna_core.hpp"
+
+// Measures engine startup with and without a warm pipeline cache.
+// Without arguments it runs itself twice: once after deleting the cache
+// file (cold) and once reusing the file written by the first run (warm).
+
+using namespace etna;
+using Clock = std::chrono::steady_clock;
+
+constexpr const char* CACHE_PATH{"etna_startup_bench.cache"};
+
+static double elapsedMs(Clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// single quoted for the shell, so paths with spaces survive std::system
+static std::string shellQuote(const std::string& arg) {
+	std::string quoted{"'"};
+
+	for (char c : arg) {
+		if (c == '\'') {
+			quoted += "'\\''";
+		} else {
+			quoted += c;
+		}
+	}
+
+	return quoted + "'";
+}
+
+static int runOnce(const std::string& label) {
+	const auto start = Clock::now();
+
+	engine::init({
+		.appName = "Etna Startup Bench",
+		.pipelineCachePath = CACHE_PATH,
+	});
+
+	const double initMs = elapsedMs(start);
+
+	const auto materialsStart = Clock::now();
+
+	engine::initDefaultMaterials();
+
+	const double materialsMs = elapsedMs(materialsStart);
+
+	// a warm run can't be faster where materials skip the cache
+	std::printf("{\"run\": \"%s\", \"initMs\": %.3f, \"materialsMs\": %.3f, "
+				"\"totalMs\": %.3f, \"materialCache\": %s}\n",
+				label.c_str(), initMs, materialsMs, elapsedMs(start),
+				engine::isPipelineCacheUsedByMaterials() ? "true" : "false");
+
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	const std::string mode = argc > 1 ? argv[1] : "";
+
+	if (mode == "--cold") {
+		std::filesystem::remove(CACHE_PATH);
+		return runOnce("cold");
+	}
+
+	if (mode == "--warm") {
+		return runOnce("warm");
+	}
+
+	const std::string self = shellQuote(argv[0]);
+
+	if (std::system((self + " --cold").c_str()) != 0) {
+		return 1;
+	}
+
+	return std::system((self + " --warm").c_str());
+}
@@ -1,7 +1,10 @@
+set(ETNA_CMAKE_DIR ${CMAKE_CURRENT_LIST_DIR})
+
 function(compile_shaders TARGET_NAME SHADER_SRC_DIR SHADER_DST_DIR)
   file(GLOB SHADER_SOURCES
     "${SHADER_SRC_DIR}/*.vert"
     "${SHADER_SRC_DIR}/*.frag"
+    "${SHADER_SRC_DIR}/*.comp"
   )
 
   set(SHADER_OUTPUTS "")
@@ -12,6 +15,13 @@ function(compile_shaders TARGET_NAME SHADER_SRC_DIR SHADER_DST_DIR)
     list(APPEND SHADER_OUTPUTS ${SHADER_OUTPUT})
     set(GLSLC_ARGS "-I${CMAKE_CURRENT_SOURCE_DIR}/include/etna/shaders")
 
+    # etna.glsl declares the per-stage draw data interface from these
+    if(SHADER_NAME MATCHES "\\.vert$")
+      list(APPEND GLSLC_ARGS "-DETNA_VERTEX_SHADER")
+    elseif(SHADER_NAME MATCHES "\\.frag$")
+      list(APPEND GLSLC_ARGS "-DETNA_FRAGMENT_SHADER")
+    endif()
+
     add_custom_command(
       OUTPUT ${SHADER_OUTPUT}
       COMMAND ${CMAKE_COMMAND} -E make_directory "${SHADER_DST_DIR}"
@@ -21,5 +31,20 @@ function(compile_shaders TARGET_NAME SHADER_SRC_DIR SHADER_DST_DIR)
     )
   endforeach()
 
+  if(ETNA_SHADER_ARCHIVE)
+    set(SHADER_ARCHIVE "${SHADER_DST_DIR}/${TARGET_NAME}.pak")
+    string(REPLACE ";" "|" SHADER_LIST "${SHADER_OUTPUTS}")
+
+    add_custom_command(
+      OUTPUT ${SHADER_ARCHIVE}
+      COMMAND ${CMAKE_COMMAND} "-DSHADERS=${SHADER_LIST}" "-DOUTPUT=${SHADER_ARCHIVE}"
+        -P "${ETNA_CMAKE_DIR}/PackShaders.cmake"
+      DEPENDS ${SHADER_OUTPUTS} "${ETNA_CMAKE_DIR}/PackShaders.cmake"
+      COMMENT "Packing shaders into ${TARGET_NAME}.pak"
+    )
+
+    list(APPEND SHADER_OUTPUTS ${SHADER_ARCHIVE})
+  endif()
+
   add_custom_target(compile_shaders_${TARGET_NAME} DEPENDS ${SHADER_OUTPUTS})
 endfunction()
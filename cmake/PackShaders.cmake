@@ -0,0 +1,50 @@
+# usage: cmake -DSHADERS="a.spv|b.spv" -DOUTPUT=out.pak -P PackShaders.cmake
+#
+# layout: ETNAPAK1\n<count>\n<name> <offset> <size>\n... padded with \n to 4 bytes,
+# followed by the spirv blobs; offsets are relative to the end of the header
+
+string(REPLACE "|" ";" SHADERS "${SHADERS}")
+list(LENGTH SHADERS SHADER_COUNT)
+
+set(INDEX "ETNAPAK1\n${SHADER_COUNT}\n")
+set(OFFSET 0)
+
+foreach(SHADER ${SHADERS})
+  get_filename_component(SHADER_NAME ${SHADER} NAME)
+  string(REGEX REPLACE "\\.spv$" "" SHADER_NAME ${SHADER_NAME})
+  file(SIZE ${SHADER} SHADER_SIZE)
+
+  string(APPEND INDEX "${SHADER_NAME} ${OFFSET} ${SHADER_SIZE}\n")
+
+  # spirv is a stream of words, so blobs stay 4-byte aligned back to back
+  math(EXPR OFFSET "${OFFSET} + ${SHADER_SIZE}")
+endforeach()
+
+string(LENGTH "${INDEX}" INDEX_SIZE)
+math(EXPR PADDING "(4 - ${INDEX_SIZE} % 4) % 4")
+
+while(PADDING GREATER 0)
+  string(APPEND INDEX "\n")
+  math(EXPR PADDING "${PADDING} - 1")
+endwhile()
+
+set(INDEX_FILE "${OUTPUT}.index")
+file(WRITE ${INDEX_FILE} "${INDEX}")
+
+set(PARTS ${INDEX_FILE})
+
+foreach(SHADER ${SHADERS})
+  list(APPEND PARTS ${SHADER})
+endforeach()
+
+execute_process(
+  COMMAND ${CMAKE_COMMAND} -E cat ${PARTS}
+  OUTPUT_FILE ${OUTPUT}
+  RESULT_VARIABLE PACK_RESULT
+)
+
+file(REMOVE ${INDEX_FILE})
+
+if(NOT PACK_RESULT EQUAL 0)
+  message(FATAL_ERROR "failed to pack ${OUTPUT}")
+endif()
@@ -131,7 +131,8 @@ inline SceneNode createFloor(const FloorCreateInfo& info) {
 	return floor;
 }
 
-struct OutlineMaterialParams {
+// 16 byte aligned to match the std430 stride of the outline shader's params
+struct alignas(16) OutlineMaterialParams {
 	Color color{WHITE};
 	Color outline{BLACK};
 	float thickness{0.01f};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include "math.hpp"
+
+namespace etna {
+
+struct Ray {
+	Vec3 origin{0, 0, 0};
+	Vec3 direction{0, 0, -1};
+	float maxDistance{std::numeric_limits<float>::infinity()};
+};
+
+struct AABB {
+	Vec3 min{0, 0, 0};
+	Vec3 max{0, 0, 0};
+
+	Vec3 center() const { return (min + max) * 0.5f; }
+
+	Vec3 extent() const { return (max - min) * 0.5f; }
+
+	// the box enclosing this one once transformed
+	AABB transform(const Mat4&) const;
+
+	// grows to enclose the other box
+	void merge(const AABB&);
+
+	bool overlaps(const AABB&) const;
+
+	bool contains(const AABB&) const;
+
+	// squared, 0 for points inside
+	float distance2(const Vec3&) const;
+
+	float surfaceArea() const;
+
+	// where the ray enters the box, infinity if it misses it before
+	// maxDistance; inline as BVH traversals call it for every node they visit
+	float rayDistance(const Vec3& origin,
+					  const Vec3& invDirection,
+					  float maxDistance) const {
+		float near{0};
+		float far{maxDistance};
+
+		for (uint32_t i{0}; i < 3; i++) {
+			const float t0 = (min[i] - origin[i]) * invDirection[i];
+			const float t1 = (max[i] - origin[i]) * invDirection[i];
+
+			near = std::max(near, std::min(t0, t1));
+			far = std::min(far, std::max(t0, t1));
+		}
+
+		return near <= far ? near : std::numeric_limits<float>::infinity();
+	}
+};
+
+struct BoundingSphere {
+	Vec3 center{0, 0, 0};
+	float radius{0};
+
+	// scales the radius by the largest axis scale, so it stays conservative
+	// under non-uniform scaling
+	BoundingSphere transform(const Mat4&) const;
+
+	bool overlaps(const AABB&) const;
+
+	bool contains(const AABB&) const;
+};
+
+// planes are (normal, distance) with unit normals pointing inside
+struct Frustum {
+	Vec4 planes[6];
+
+	// Gribb-Hartmann extraction from a projection * view matrix
+	static Frustum fromMatrix(const Mat4& viewProj);
+
+	bool intersects(const BoundingSphere&) const;
+
+	bool intersects(const AABB&) const;
+
+	// whether the box is entirely inside
+	bool contains(const AABB&) const;
+};
+
+}  // namespace etna
@@ -3,11 +3,19 @@
 #include "ignis/types.hpp"
 #include "transform.hpp"
 #include "math.hpp"
+#include "bounds.hpp"
+#include "engine.hpp"
 
 namespace etna {
 
 class Camera {
 public:
+	struct CameraData {
+		Mat4 viewproj;
+		Mat4 view;
+		Mat4 proj;
+	};
+
 	struct CreateInfo {
 		float fov{70.f};
 		float near{0.1f};
@@ -25,7 +33,18 @@ public:
 
 	Mat4 getViewProjMatrix() const { return m_projMatrix * m_viewMatrix; }
 
-	ignis::BufferId getDataBuffer() const { return m_cameraData; }
+	// world space
+	Frustum getFrustum() const { return Frustum::fromMatrix(getViewProjMatrix()); }
+
+	engine::UniformHandle getDataBuffer() const { return m_cameraData; }
+
+	CameraData getData() const {
+		return {
+			.viewproj = getViewProjMatrix(),
+			.view = m_viewMatrix,
+			.proj = m_projMatrix,
+		};
+	}
 
 	void updateTransform(const Transform&);
 	void updateTransform(const Mat4&);
@@ -36,12 +55,6 @@ public:
 	void updateFar(float);
 
 private:
-	struct CameraData {
-		Mat4 viewproj;
-		Mat4 view;
-		Mat4 proj;
-	};
-
 	float m_fov;
 	float m_near;
 	float m_far;
@@ -51,7 +64,7 @@ private:
 	Mat4 m_projMatrix;
 	Mat4 m_viewMatrix;
 
-	ignis::BufferId m_cameraData{IGNIS_INVALID_BUFFER_ID};
+	engine::UniformHandle m_cameraData{engine::INVALID_UNIFORM};
 
 public:
 	Camera(const Camera&) = delete;
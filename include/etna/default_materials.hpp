@@ -9,7 +9,8 @@ MaterialHandle createColorMaterial(Color color = WHITE);
 
 MaterialHandle createPointMaterial(Color color = WHITE);
 
-struct GridMaterialParams {
+// 16 byte aligned to match the std430 stride of the grid shaders' params
+struct alignas(16) GridMaterialParams {
 	Color color{WHITE};
 	Color gridColor{BLACK};
 	float gridSpacing{0.1};
@@ -20,6 +21,13 @@ MaterialHandle createGridMaterial(GridMaterialParams);
 
 MaterialHandle createTransparentGridMaterial(GridMaterialParams);
 
+// drawn in place of materials whose pipeline is still compiling; defaults to
+// a gray color material
+MaterialHandle getFallbackMaterial();
+
+void setFallbackMaterial(MaterialHandle);
+
+// compiles every default template up front, in parallel on the workers
 void initDefaultMaterials();
 
 void initColorMaterial();
@@ -38,4 +46,9 @@ RawShader getDefaultFragShader();
 
 RawShader getGridFragShader();
 
+// compute shaders of the renderer's GPU culling
+RawShader getCullCompShader();
+
+RawShader getHiZCompShader();
+
 }  // namespace etna::engine
@@ -1,34 +1,94 @@
 #pragma once
 
 #include <functional>
+#include <future>
+#include <memory>
+#include <span>
+#include <type_traits>
 #include "ignis/image.hpp"
 #include "ignis/device.hpp"
 #include "ignis/swapchain.hpp"
 #include "ignis/semaphore.hpp"
 #include "math.hpp"
+#include "memory.hpp"
 
 namespace etna::engine {
 
 struct InitInfo {
 	std::string appName{"Etna App"};
 	std::string shadersFolder{"shaders"};
+	// loaded at init and written back at exit; empty keeps it in memory
+	std::string pipelineCachePath{};
+	// packed by compile_shaders when ETNA_SHADER_ARCHIVE is on; shaders are
+	// looked up here before falling back to shadersFolder
+	std::vector<std::string> shaderArchives{};
+	// etna's own src.pak when built with ETNA_SHADER_ARCHIVE; empty looks
+	// next to the executable, then in the build tree
+	std::string engineShaderArchive{};
+	// for runAsync tasks; 0 picks one less than the core count
+	uint32_t workerThreads{0};
+	// no GLFW and no surface or swapchain extensions: only plain
+	// RenderTargets can be drawn to, windows can't be created
+	bool headless{false};
+	// frame time report written at exit, see writeFrameTimeReport
+	std::string frameReportPath{};
 };
 
 void init(const InitInfo& = {});
 
 ignis::Device& getDevice();
 
+bool isHeadless();
+
+// Identifies a queue submission; tokens are handed out in submission order,
+// so once a token completes all the previous ones have completed too
+using CompletionToken = uint64_t;
+
 void immediateSubmit(std::function<void(ignis::Command&)>&&);
 
+// copies data through the staging ring and waits for this upload only
 void immediateUpload(ignis::BufferId,
 					 const void* data,
 					 VkDeviceSize offset = 0,
 					 VkDeviceSize size = 0);
 
-void immediateUpdate(ignis::BufferId,
-					 const void* data,
-					 VkDeviceSize offset = 0,
-					 VkDeviceSize size = 0);
+// copies data through the staging ring without waiting; draws recorded
+// afterwards are guaranteed to see the new contents
+CompletionToken immediateUpdate(ignis::BufferId,
+								const void* data,
+								VkDeviceSize offset = 0,
+								VkDeviceSize size = 0);
+
+CompletionToken upload(ignis::BufferId,
+					   const void* data,
+					   VkDeviceSize offset = 0,
+					   VkDeviceSize size = 0);
+
+CompletionToken upload(const ignis::Buffer&,
+					   const void* data,
+					   VkDeviceSize offset = 0,
+					   VkDeviceSize size = 0);
+
+// submits the pending upload batch; called before any other submission so
+// that queue order matches token order
+CompletionToken flushUploads();
+
+bool isComplete(CompletionToken);
+
+void waitFor(CompletionToken);
+
+// reserves the token of the submission that is about to be made
+CompletionToken nextToken();
+
+void signalToken(CompletionToken);
+
+CompletionToken getCompletedToken();
+
+// resources released while a frame is being recorded are retired only once
+// that frame has completed
+void beginFrameRecording();
+
+void endFrameRecording(CompletionToken);
 
 void presentCurrent(const ignis::Swapchain&, std::vector<const ignis::Semaphore*>);
 
@@ -36,32 +96,180 @@ ignis::Command createGraphicsCommand();
 
 ignis::Command* newGraphicsCommand();
 
+ignis::Command* newUploadCommand();
+
 void queueForDeletion(std::function<void()>);
 
+// runs func once the GPU has finished every submission that could still
+// reference the resource it releases
+void queueForRetirement(std::function<void()>);
+
+// category gives the buffer's bytes back to the memory tracker once it is
+// destroyed
+void retireBuffer(ignis::BufferId,
+				  MemoryCategory category = MemoryCategory::UNTRACKED);
+
+void retireResources();
+
 uint32_t clampSampleCount(uint32_t sampleCount);
 
-ignis::Shader* newShader(const std::string& path);
+// index of a memory type allowed by typeBits with all of flags, UINT32_MAX if
+// there is none
+uint32_t findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags flags);
+
+VkPipelineCache getPipelineCache();
+
+// false when the ignis build can't take a pipeline cache, leaving material
+// pipelines uncached; etna's compute pipelines always use it
+bool isPipelineCacheUsedByMaterials();
 
-ignis::Shader* newShader(const unsigned char*, size_t, VkShaderStageFlagBits);
+using ShaderHandle = std::shared_ptr<ignis::Shader>;
+
+// shader modules are cached by content, so the same SPIR-V is only turned
+// into a module once while someone holds it
+ShaderHandle getShader(const std::string& name);
+
+ShaderHandle getShader(const unsigned char*, size_t, VkShaderStageFlagBits);
+
+// empty if no mapped archive contains name
+std::span<const unsigned char> getArchivedShader(const std::string& name);
+
+// runs task on the engine worker pool
+std::future<void> runAsync(std::function<void()> task);
 
 float getDeltaTime();
 
+// call once per frame: measures the time since the previous call on a
+// monotonic clock and feeds the frame time histogram
 float updateTime();
 
+// frame time distribution over the last FRAME_TIME_WINDOW frames
+struct FrameTimeStats {
+	uint32_t frames;
+	double meanMs;
+	double p50Ms;
+	double p95Ms;
+	double p99Ms;
+	double maxMs;
+	// frames longer than twice the median, since the last reset
+	uint64_t stutters;
+	// per-frame means of the time spent blocked on GPU fences and the rest
+	double waitMs;
+	double workMs;
+};
+
+FrameTimeStats getFrameTimeStats();
+
+void resetFrameTimeStats();
+
+// buffer updates and immediate submits since startup; always zero when
+// built without ETNA_STATS
+struct TransferCounters {
+	uint32_t bufferUpdates;
+	uint64_t bufferUpdateBytes;
+	uint32_t immediateSubmits;
+};
+
+TransferCounters getTransferCounters();
+
+// counts a write to a device buffer, whether updateBuffer or an upload
+// through the staging ring
+void countBufferUpdate(VkDeviceSize size);
+
+// _device.updateBuffer, counted in the transfer counters
+void updateBuffer(ignis::BufferId,
+				  const void* data,
+				  VkDeviceSize offset = 0,
+				  VkDeviceSize size = 0);
+
+// Small uniform blocks suballocated from shared storage pages, so a material
+// or a light doesn't cost a buffer of its own. A handle packs the page's
+// buffer id with the block's slot in it; shaders read it with UNIFORM().
+using UniformHandle = uint32_t;
+
+constexpr UniformHandle INVALID_UNIFORM{IGNIS_INVALID_BUFFER_ID};
+
+constexpr uint32_t UNIFORM_SLOT_BITS{12};
+
+// blocks sit in the pages at their size rounded up to 16 bytes, while DEF_UBO
+// declares std430 arrays strided by the GLSL struct's own alignment. The two
+// agree when the struct contains a vec4 or mat4, or is a multiple of 16
+// bytes; on the C++ side that is a 16 byte aligned or padded struct
+template <typename T>
+constexpr bool IS_UNIFORM_BLOCK = alignof(T) % 16 == 0 || sizeof(T) % 16 == 0;
+
+UniformHandle allocateUniform(size_t size,
+							  const void* data = nullptr,
+							  MemoryCategory category = MemoryCategory::UNTRACKED);
+
+template <typename T>
+	requires std::is_class_v<T>
+UniformHandle allocateUniform(const T& data,
+							  MemoryCategory category = MemoryCategory::UNTRACKED) {
+	static_assert(IS_UNIFORM_BLOCK<T>, "align the block to 16 bytes or pad it");
+	return allocateUniform(sizeof(T), &data, category);
+}
+
+// ordered on the GPU timeline: frames already submitted read the old
+// contents, frames recorded afterwards the new ones
+void updateUniform(UniformHandle, const void* data, size_t size);
+
+template <typename T>
+	requires std::is_class_v<T>
+void updateUniform(UniformHandle handle, const T& data) {
+	static_assert(IS_UNIFORM_BLOCK<T>, "align the block to 16 bytes or pad it");
+	updateUniform(handle, &data, sizeof(T));
+}
+
+// the slot is reused once the GPU is done with the frames that could read it
+void freeUniform(UniformHandle,
+				 MemoryCategory category = MemoryCategory::UNTRACKED);
+
+struct UniformArenaStats {
+	uint32_t pages;
+	uint32_t blocks;
+	VkDeviceSize pageBytes;
+};
+
+UniformArenaStats getUniformArenaStats();
+
+// waits on fence and counts the blocked time as frame wait
+void waitFence(ignis::Fence& fence);
+
+void writeFrameTimeReport(const std::string& path);
+
 constexpr ignis::ColorFormat COLOR_FORMAT{ignis::ColorFormat::RGBA16};
 
 constexpr ignis::DepthFormat DEPTH_FORMAT{ignis::DepthFormat::D32_SFLOAT};
 
 constexpr uint32_t MAX_SAMPLE_COUNT{8};
 
+constexpr VkDeviceSize STAGING_RING_SIZE{32 * 1024 * 1024};
+
+constexpr uint32_t FRAME_TIME_WINDOW{1024};
+
+constexpr VkDeviceSize UNIFORM_PAGE_SIZE{64 * 1024};
+
+constexpr VkDeviceSize FRAME_STORAGE_CHUNK_SIZE{1024 * 1024};
+
 struct PushConstants {
 	Mat4 model;
 	ignis::BufferId vertices;
-	ignis::BufferId material;
+	UniformHandle material;
 	ignis::BufferId instanceBuffer;
 	ignis::BufferId buff1;
 	ignis::BufferId buff2;
 	ignis::BufferId buff3;
+	ignis::BufferId drawData;
+};
+
+// per-draw data of batched and indirect draws, read by MODEL, V and MATERIAL
+// when drawData is set; 80 bytes like the std430 struct in etna.glsl
+struct DrawRecord {
+	Mat4 model;
+	UniformHandle material;
+	ignis::BufferId vertices;
+	uint32_t padding[2];
 };
 
 }  // namespace etna::engine
@@ -1,5 +1,8 @@
 #include "etna/engine.hpp"
 #include "etna/window.hpp"
 #include "etna/renderer.hpp"
+#include "etna/render_queue.hpp"
+#include "etna/gpu_profiler.hpp"
+#include "etna/trace.hpp"
 #include "etna/default_materials.hpp"
 #include "etna/default_primitives.hpp"
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+#include "ignis/command.hpp"
+
+namespace etna {
+
+struct GpuScopeResult {
+	std::string name;
+	uint32_t depth;
+	double startMs;  // relative to the first profiled frame
+	double durationMs;
+};
+
+struct GpuFrameResult {
+	uint64_t frame;
+	std::vector<GpuScopeResult> scopes;
+};
+
+// Timestamp queries ring-buffered per frame in flight: a frame's results are
+// only read back when its slot comes around again, after the renderer has
+// waited on that slot, so collecting them never stalls.
+class GpuProfiler {
+public:
+	struct CreateInfo {
+		uint32_t framesInFlight{2};
+		uint32_t maxScopes{64};
+		uint32_t historySize{240};
+	};
+
+	GpuProfiler(const CreateInfo&);
+
+	~GpuProfiler();
+
+	// collects the results of the slot about to be reused and resets it;
+	// must be recorded outside of a render pass
+	void beginFrame(ignis::Command&);
+
+	// returns NO_SCOPE when the frame ran out of queries
+	uint32_t beginScope(ignis::Command&, const char* name);
+
+	void endScope(ignis::Command&, uint32_t scope);
+
+	// oldest first, at most historySize frames
+	const std::deque<GpuFrameResult>& getHistory() const { return m_history; }
+
+	void writeCSV(const std::string& path) const;
+
+	void writeChromeTrace(const std::string& path) const;
+
+	static constexpr uint32_t NO_SCOPE{~0u};
+
+private:
+	struct Slot {
+		uint64_t frame{0};
+		bool recorded{false};
+		std::vector<std::string> names;
+		std::vector<uint32_t> depths;
+		uint32_t openScopes{0};
+	};
+
+	void collect(Slot&, uint32_t slotIndex);
+
+	CreateInfo m_info;
+	VkQueryPool m_queryPool{VK_NULL_HANDLE};
+	double m_timestampPeriod{1};
+
+	std::vector<Slot> m_slots;
+	uint32_t m_currentSlot{0};
+	uint64_t m_frameCount{0};
+
+	uint64_t m_epoch{0};
+	bool m_hasEpoch{false};
+
+	std::deque<GpuFrameResult> m_history;
+
+public:
+	GpuProfiler(const GpuProfiler&) = delete;
+	GpuProfiler(GpuProfiler&&) = delete;
+	GpuProfiler& operator=(const GpuProfiler&) = delete;
+	GpuProfiler& operator=(GpuProfiler&&) = delete;
+};
+
+// records a scope for its lifetime; a null profiler makes it a no-op
+class GpuScope {
+public:
+	GpuScope(GpuProfiler* profiler, ignis::Command& cmd, const char* name)
+		: m_profiler(profiler), m_cmd(cmd) {
+		if (m_profiler != nullptr) {
+			m_scope = m_profiler->beginScope(m_cmd, name);
+		}
+	}
+
+	~GpuScope() {
+		if (m_profiler != nullptr) {
+			m_profiler->endScope(m_cmd, m_scope);
+		}
+	}
+
+private:
+	GpuProfiler* m_profiler;
+	ignis::Command& m_cmd;
+	uint32_t m_scope{GpuProfiler::NO_SCOPE};
+
+public:
+	GpuScope(const GpuScope&) = delete;
+	GpuScope(GpuScope&&) = delete;
+	GpuScope& operator=(const GpuScope&) = delete;
+	GpuScope& operator=(GpuScope&&) = delete;
+};
+
+}  // namespace etna
@@ -3,6 +3,7 @@
 #include "ignis/types.hpp"
 #include "color.hpp"
 #include "math.hpp"
+#include "engine.hpp"
 
 namespace etna {
 
@@ -17,7 +18,7 @@ struct DirectionalLight {
 	DirectionalLight(const CreateInfo&);
 	~DirectionalLight();
 
-	ignis::BufferId getDataBuffer() const { return m_buffer; }
+	engine::UniformHandle getDataBuffer() const { return m_buffer; }
 
 	Vec3 getDirection() const { return m_info.direction; }
 	float getIntensity() const { return m_info.intensity; }
@@ -35,7 +36,7 @@ struct DirectionalLight {
 private:
 	CreateInfo m_info;
 
-	ignis::BufferId m_buffer{IGNIS_INVALID_BUFFER_ID};
+	engine::UniformHandle m_buffer{engine::INVALID_UNIFORM};
 
 	// TEMP: will contain also info for shadows (viewproj etc.)
 	struct DirectionalLightData {
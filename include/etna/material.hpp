@@ -1,8 +1,11 @@
 #pragma once
 
+#include <atomic>
+#include <future>
 #include <memory>
 #include "ignis/types.hpp"
 #include "ignis/pipeline.hpp"
+#include "engine.hpp"
 
 namespace etna {
 
@@ -22,19 +25,60 @@ public:
 		VkPolygonMode polygonMode{VK_POLYGON_MODE_FILL};
 		float lineWidth{1.0f};
 		uint32_t samples{0};
+		// compile the pipeline on the worker pool; until it is ready the
+		// renderer draws with the fallback material
+		bool async{false};
+		// the vertex shader reads MODEL and V and calls FORWARD_DRAW_DATA(),
+		// so scenes may merge draws into instanced or indirect ones
+		bool autoInstancing{false};
 	};
 
 	~MaterialTemplate();
 
+	// templates with the same shaders and pipeline state share one instance
 	static std::shared_ptr<MaterialTemplate> create(const CreateInfo&);
 
-	auto& getPipeline() const { return *m_pipeline; }
+	auto& getPipeline() const {
+		assert(isReady() && "Pipeline still compiling");
+		return *m_pipeline.load(std::memory_order_acquire);
+	}
+
+	bool isReady() const {
+		return m_pipeline.load(std::memory_order_acquire) != nullptr;
+	}
+
+	// blocks until an async compile has finished; rethrows its error
+	void waitReady();
+
+	bool isTransparent() const { return m_key.transparency; }
+
+	bool allowsAutoInstancing() const { return m_key.autoInstancing; }
+
+	// dense, in creation order; used to build sort keys
+	uint32_t getId() const { return m_id; }
+
+	struct StateKey {
+		std::vector<std::string> shaders;
+		std::vector<const unsigned char*> rawShaders;
+		bool enableDepth;
+		bool transparency;
+		VkPolygonMode polygonMode;
+		float lineWidth;
+		uint32_t samples;
+		bool autoInstancing;
+
+		bool operator==(const StateKey&) const = default;
+	};
 
 private:
 	MaterialTemplate(const CreateInfo&);
 
-	std::vector<ignis::Shader*> m_shaders;
-	ignis::Pipeline* m_pipeline{nullptr};
+	std::vector<engine::ShaderHandle> m_shaders;
+	// published by the worker once an async compile is done
+	std::atomic<ignis::Pipeline*> m_pipeline{nullptr};
+	std::future<void> m_compile;
+	StateKey m_key;
+	uint32_t m_id;
 };
 
 using MaterialTemplateHandle = std::shared_ptr<MaterialTemplate>;
@@ -43,12 +87,15 @@ class Material {
 public:
 	struct CreateInfo {
 		std::shared_ptr<MaterialTemplate> templateHandle;
+		// a multiple of 16 bytes, the std430 stride of the params array the
+		// shaders index; anything else throws
 		size_t paramsSize{0};
 		const void* params{nullptr};
 	};
 
 	Material(const CreateInfo&);
 
+	// paramsSize as in CreateInfo
 	Material(const MaterialTemplate::CreateInfo&, size_t paramsSize = 0);
 
 	static std::shared_ptr<Material> create(const CreateInfo&);
@@ -63,8 +110,13 @@ public:
 
 	auto getParamsUBO() const { return m_paramsUBO; }
 
+	// dense, in creation order; used to build sort keys
+	uint32_t getId() const { return m_id; }
+
 private:
-	ignis::BufferId m_paramsUBO{IGNIS_INVALID_BUFFER_ID};
+	uint32_t m_id;
+	engine::UniformHandle m_paramsUBO{engine::INVALID_UNIFORM};
+	size_t m_paramsSize{0};
 	std::shared_ptr<MaterialTemplate> m_materialTemplate;
 
 public:
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <string>
+#include <vector>
+#include "ignis/types.hpp"
+
+namespace etna::engine {
+
+enum class MemoryCategory {
+	MESH,
+	MATERIAL_PARAMS,
+	INSTANCE_BUFFER,
+	RENDER_TARGET,
+	OBJECT_UBO,  // cameras, lights, scenes and per-frame data
+	STAGING,
+	UNTRACKED,
+};
+
+constexpr size_t MEMORY_CATEGORY_COUNT{
+	static_cast<size_t>(MemoryCategory::UNTRACKED)};
+
+const char* getMemoryCategoryName(MemoryCategory);
+
+struct HeapBudget {
+	VkDeviceSize size;
+	// zero when VK_EXT_memory_budget is not available
+	VkDeviceSize budget;
+	VkDeviceSize usage;
+	bool deviceLocal;
+};
+
+struct MemoryReport {
+	std::array<VkDeviceSize, MEMORY_CATEGORY_COUNT> bytes;
+	VkDeviceSize total;
+	bool hasBudget;
+	std::vector<HeapBudget> heaps;
+};
+
+// bytes are what the engine asked for, allocator padding is not included
+void trackMemory(MemoryCategory, int64_t bytes);
+
+// adds the size of buffer to category; pass the same category to
+// retireBuffer to give it back
+void trackBuffer(ignis::BufferId buffer, MemoryCategory);
+
+MemoryReport getMemoryReport();
+
+std::string formatMemoryReport(const MemoryReport&);
+
+// called once every time the tracked total goes above threshold bytes; it
+// re-arms when the total drops back under it
+void setMemoryThreshold(VkDeviceSize threshold,
+						std::function<void(const MemoryReport&)> callback);
+
+}  // namespace etna::engine
@@ -1,10 +1,15 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <vector>
 #include "ignis/types.hpp"
 #include "ignis/buffer.hpp"
+#include "engine.hpp"
 #include "math.hpp"
+#include "bounds.hpp"
+#include "triangle_bvh.hpp"
 
 namespace etna {
 
@@ -21,6 +26,10 @@ public:
 	struct CreateInfo {
 		std::vector<Vertex> vertices;
 		std::vector<Index> indices;
+		// keep a CPU copy of the positions and indices so Scene::raycast can
+		// hit the mesh; turn it off for meshes never picked to save the copy.
+		// Read at creation only, meshes without it are skipped
+		bool raycast{true};
 	};
 
 	static std::shared_ptr<Mesh> create(const CreateInfo&);
@@ -29,7 +38,10 @@ public:
 
 	~Mesh();
 
-	void update(const CreateInfo&);
+	engine::CompletionToken update(const CreateInfo&);
+
+	// true once the last update has landed on the GPU
+	bool isUploaded() const { return engine::isComplete(m_uploadToken); }
 
 	uint32_t indexCount() const;
 
@@ -39,9 +51,46 @@ public:
 
 	auto getIndexBuffer() const { return m_indexBuffer; }
 
+	// dense, in creation order; used to build sort keys
+	uint32_t getId() const { return m_id; }
+
+	// local space, recomputed by update
+	const AABB& getBounds() const { return m_bounds; }
+
+	// bumped by every update that changes the bounds
+	uint32_t getBoundsVersion() const { return m_boundsVersion; }
+
+	// bumped whenever the bounds of any mesh change, so scene BVHs only look
+	// for stale items after such an update
+	static uint64_t getBoundsEpoch();
+
+	const BoundingSphere& getBoundingSphere() const { return m_sphere; }
+
+	bool isRaycastable() const { return m_raycast; }
+
+	// built on first use from a copy of the positions and indices of the last
+	// update, dropped once built; safe to call from several threads, but not
+	// while the mesh is updated. Only for raycastable meshes
+	const TriangleBvh& getTriangleBvh() const;
+
 private:
+	void computeBounds(const std::vector<Vertex>&);
+
+	uint32_t m_id;
+	bool m_raycast;
+	AABB m_bounds;
+	BoundingSphere m_sphere;
+	uint32_t m_boundsVersion{0};
 	ignis::BufferId m_vertexBuffer{IGNIS_INVALID_BUFFER_ID};
 	ignis::Buffer* m_indexBuffer{nullptr};
+	engine::CompletionToken m_uploadToken{0};
+
+	// the input of getTriangleBvh
+	mutable std::vector<Vec3> m_positions;
+	mutable std::vector<Index> m_indices;
+	mutable std::unique_ptr<TriangleBvh> m_triangleBvh;
+	mutable std::atomic<bool> m_triangleBvhReady{false};
+	mutable std::mutex m_triangleBvhMutex;
 
 public:
 	Mesh(const Mesh&) = delete;
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+#include "renderer.hpp"
+
+namespace etna {
+
+struct QueueSubmitInfo {
+	// needs the MultiDrawIndirect and DrawIndirectFirstInstance features, see
+	// Renderer::supportsIndirect
+	bool indirect{false};
+	// ignored unless indirect and the renderer has GPU culling
+	std::optional<GpuCullView> cullView;
+};
+
+// Collects the draws of a frame and submits them sorted: opaque draws by
+// (pipeline, material, mesh, coarse front-to-back depth) so consecutive draws
+// share state, transparent ones back-to-front after all the opaque ones.
+//
+// After sorting, runs of opaque draws with the same mesh and material whose
+// template allows autoInstancing are merged into one instanced draw, their
+// draw records packed into per-frame renderer storage. In indirect mode the
+// runs only need to share pipeline and mesh, and each becomes one
+// multi-draw indirect call with a command per draw. Given a cull view and a
+// renderer with GPU culling, those commands are culled on the GPU first.
+//
+// Keys are radix sorted; keep the queue around between frames so its
+// storage is reused.
+class RenderQueue {
+public:
+	RenderQueue() = default;
+
+	void clear();
+
+	// depth is the view space distance along the camera axis; bounds are in
+	// world space and only read by GPU culling
+	void push(const DrawSettings&, float depth, const BoundingSphere& bounds = {});
+
+	void submit(Renderer&, const QueueSubmitInfo& = {});
+
+	size_t size() const { return m_draws.size(); }
+
+private:
+	struct SortPacket {
+		uint64_t key;
+		uint32_t draw;
+	};
+
+	// count consecutive opaque packets drawn as one
+	struct Batch {
+		uint32_t packet;
+		uint32_t count;
+		uint32_t firstRecord;
+		bool indirect;
+		// of the indirect commands and GPU cull ranges
+		uint32_t firstCommand;
+		uint32_t range;
+	};
+
+	void buildBatches(bool indirect);
+
+	std::vector<DrawSettings> m_draws;
+	std::vector<float> m_depths;
+	std::vector<BoundingSphere> m_bounds;
+
+	std::vector<SortPacket> m_opaque;
+	std::vector<SortPacket> m_transparent;
+	std::vector<SortPacket> m_scratch;
+
+	std::vector<Batch> m_batches;
+	std::vector<engine::DrawRecord> m_records;
+	std::vector<VkDrawIndexedIndirectCommand> m_commands;
+	std::vector<BoundingSphere> m_commandBounds;
+	std::vector<CullRange> m_cullRanges;
+
+public:
+	RenderQueue(const RenderQueue&) = delete;
+	RenderQueue(RenderQueue&&) = delete;
+	RenderQueue& operator=(const RenderQueue&) = delete;
+	RenderQueue& operator=(RenderQueue&&) = delete;
+};
+
+}  // namespace etna
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include "ignis/command.hpp"
 
 namespace etna {
@@ -32,13 +33,20 @@ public:
 
 	CreateInfo getCreationInfo() const { return m_creationInfo; }
 
+	// unique for the lifetime of the process, unlike the address
+	uint32_t getId() const { return m_id; }
+
 private:
+	uint32_t m_id;
+
 	ignis::Image* m_drawImage{nullptr};
 	ignis::Image* m_depthImage{nullptr};
 	ignis::Image* m_resolvedImage{nullptr};
 
 	CreateInfo m_creationInfo;
 
+	VkDeviceSize m_memoryBytes{0};
+
 public:
 	RenderTarget(const RenderTarget&) = delete;
 	RenderTarget(RenderTarget&&) = delete;
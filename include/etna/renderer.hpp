@@ -1,12 +1,15 @@
 #pragma once
 
 #include <cstdint>
+#include <optional>
+#include <span>
 #include "ignis/command.hpp"
 #include "ignis/fence.hpp"
 #include "mesh.hpp"
 #include "material.hpp"
 #include "render_target.hpp"
 #include "color.hpp"
+#include "gpu_profiler.hpp"
 
 namespace etna {
 
@@ -31,11 +34,76 @@ struct DrawSettings {
 	MaterialHandle material{nullptr};
 	Mat4 transform{};
 	Viewport viewport;
+	// buffer ids or uniform handles, whichever the shaders expect. The scene
+	// shaders read SCENE and CAMERA with UNIFORM(), so there buff1 and buff2
+	// are engine::UniformHandles; plain UBO ids no longer work
 	ignis::BufferId buff1{IGNIS_INVALID_BUFFER_ID};
 	ignis::BufferId buff2{IGNIS_INVALID_BUFFER_ID};
 	ignis::BufferId buff3{IGNIS_INVALID_BUFFER_ID};
 	ignis::BufferId instanceBuffer{IGNIS_INVALID_BUFFER_ID};
 	uint32_t instanceCount{1};
+	// per-instance engine::DrawRecords read in place of transform, mesh
+	// and material params, starting at firstInstance
+	ignis::BufferId drawData{IGNIS_INVALID_BUFFER_ID};
+	uint32_t firstInstance{0};
+};
+
+struct IndirectDrawSettings {
+	// supplies the index buffer, so every command draws from this mesh
+	MeshHandle mesh{nullptr};
+	// supplies the pipeline; model, vertices and material params of each
+	// draw come from its record in drawData
+	MaterialHandle material{nullptr};
+	Viewport viewport;
+	ignis::BufferId buff1{IGNIS_INVALID_BUFFER_ID};
+	ignis::BufferId buff2{IGNIS_INVALID_BUFFER_ID};
+	ignis::BufferId buff3{IGNIS_INVALID_BUFFER_ID};
+	ignis::BufferId drawData{IGNIS_INVALID_BUFFER_ID};
+	// firstInstance picks the record; copied into the current frame slot
+	std::span<const VkDrawIndexedIndirectCommand> commands;
+	// draws what survived of this range of the last cullIndirect instead;
+	// commands then only bounds the count
+	uint32_t cullRange{NO_CULL_RANGE};
+
+	static constexpr uint32_t NO_CULL_RANGE{~0u};
+};
+
+// commands [first, first + count) of a cullIndirect call, compacted on their
+// own so each range can be drawn with its own state
+struct CullRange {
+	uint32_t first;
+	uint32_t count;
+};
+
+struct GpuCullView {
+	Mat4 viewProj;
+	Viewport viewport;
+};
+
+class GpuCuller;
+
+// counters of the current frame, reset by beginFrame; always zero when built
+// without ETNA_STATS
+struct RenderStats {
+	uint32_t drawCalls;
+	uint32_t instances;
+	uint64_t triangles;
+	uint32_t pipelineBinds;
+	uint32_t indexBufferBinds;
+	// binds and dynamic state skipped because they were already set
+	uint32_t skippedPipelineBinds;
+	uint32_t skippedIndexBufferBinds;
+	uint32_t skippedStateSets;
+	// draws issued by the multi-draw indirect calls counted in drawCalls
+	uint32_t indirectCommands;
+	// draws skipped by frustum culling, reported through countCulled
+	uint32_t culledDraws;
+	// only the ranges that changed since the previous draw are sent
+	uint64_t pushConstantBytes;
+	// updateBuffer calls and staging uploads, uniform updates included
+	uint32_t bufferUpdates;
+	uint64_t bufferUpdateBytes;
+	uint32_t immediateSubmits;
 };
 
 constexpr RenderFrameSettings LOAD_PREVIOUS{
@@ -46,6 +114,14 @@ class Renderer {
 public:
 	struct CreateInfo {
 		uint32_t framesInFlight{2};
+		// optional; records "frame", "resolve" and the scene scopes
+		GpuProfiler* profiler{nullptr};
+		// skip binds and dynamic state the command buffer already has; off
+		// only to measure what that saves
+		bool elideRedundantState{true};
+		// enables cullIndirect when the device supports it; frames then
+		// always store their depth, which the occlusion test reads back
+		bool gpuCulling{false};
 	};
 
 	Renderer(const CreateInfo&);
@@ -57,18 +133,132 @@ public:
 
 	void draw(const DrawSettings& = {});
 
+	// one vkCmdDrawIndexedIndirect over all the commands
+	void drawIndirect(const IndirectDrawSettings&);
+
+	// whether the device has the features drawIndirect needs
+	static bool supportsIndirect();
+
+	// Tests each command's world space bounds against the view's frustum and
+	// the depth of the previous frame, compacting the survivors of every
+	// range; draw them with drawIndirect and cullRange. Runs a compute pass,
+	// so rendering is suspended and resumed with the attachments loaded.
+	void cullIndirect(std::span<const VkDrawIndexedIndirectCommand>,
+					  std::span<const BoundingSphere>,
+					  std::span<const CullRange>,
+					  const GpuCullView&);
+
+	bool hasGpuCulling() const { return m_culler != nullptr; }
+
+	static bool supportsGpuCulling();
+
 	void clearViewport(Viewport viewport, Color color = {});
 
 	ignis::Command& getCommand() const { return *m_frames[m_currentFrame].cmd; }
 
 	const RenderTarget& getRenderTarget() const { return *m_currTarget; }
 
+	uint32_t getFrameIndex() const { return m_currentFrame; }
+
+	uint32_t getFramesInFlight() const { return m_framesInFlight; }
+
+	GpuProfiler* getProfiler() const { return m_profiler; }
+
+	RenderStats getStats() const;
+
+	void countCulled(uint32_t count);
+
+	// draw assumes nothing else binds state in between; call this after
+	// recording binds directly into getCommand()
+	void invalidateState() { m_bound = {}; }
+
+	// returns a uniform block owned by the current frame slot; it is safe to
+	// overwrite it every frame since the slot is only reused once the GPU is
+	// done with it
+	engine::UniformHandle allocateFrameUBO(size_t size, const void* data);
+
+	template <typename T>
+		requires std::is_class_v<T>
+	engine::UniformHandle allocateFrameUBO(const T& data) {
+		static_assert(engine::IS_UNIFORM_BLOCK<T>,
+					  "align the block to 16 bytes or pad it");
+		return allocateFrameUBO(sizeof(T), &data);
+	}
+
+	struct FrameStorage {
+		ignis::BufferId buffer;
+		// offset in units of stride
+		uint32_t first;
+	};
+
+	// copies data into storage owned by the current frame slot, at an offset
+	// that is a multiple of stride so shaders can index it as an array
+	FrameStorage allocateFrameStorage(size_t size, const void* data, size_t stride);
+
 private:
+	struct FrameUBO {
+		size_t size;
+		engine::UniformHandle handle;
+	};
+
+	struct StorageChunk {
+		ignis::BufferId buffer;
+		VkDeviceSize size;
+		VkDeviceSize used;
+	};
+
+	// host visible indirect buffers: ignis buffers can't be used as the
+	// source of indirect draws
+	struct IndirectChunk {
+		VkBuffer buffer;
+		VkDeviceMemory memory;
+		void* mapped;
+		VkDeviceSize size;
+		VkDeviceSize used;
+	};
+
+	struct IndirectAllocation {
+		VkBuffer buffer;
+		VkDeviceSize offset;
+		void* mapped;
+	};
+
 	struct FrameData {
 		ignis::Fence* inFlight;
 		ignis::Command* cmd;
+		bool submitted{false};
+		engine::CompletionToken token{0};
+		std::vector<FrameUBO> ubos;
+		uint32_t usedUBOs{0};
+		std::vector<StorageChunk> storage;
+		uint32_t currentChunk{0};
+		std::vector<IndirectChunk> indirect;
+		uint32_t currentIndirect{0};
 	};
 
+	// what the current command buffer has bound
+	struct BoundState {
+		const ignis::Pipeline* pipeline{nullptr};
+		const ignis::Buffer* indexBuffer{nullptr};
+		std::optional<VkViewport> viewport;
+		bool scissor{false};
+		std::optional<engine::PushConstants> pushConstants;
+	};
+
+	void waitFrame(FrameData&);
+
+	void beginRendering(const RenderFrameSettings&);
+
+	void bindState(ignis::Pipeline&, const Mesh&, const Viewport&);
+
+	void pushDrawConstants(ignis::Pipeline&, const engine::PushConstants&);
+
+	static IndirectChunk createIndirectChunk(VkDeviceSize size);
+
+	static void destroyIndirectChunk(const IndirectChunk&);
+
+	IndirectAllocation allocateIndirect(VkDeviceSize size);
+
 	const RenderTarget* m_currTarget{nullptr};
 
 	std::vector<FrameData> m_frames;
@@ -76,6 +266,19 @@ private:
 	uint32_t m_framesInFlight;
 	uint32_t m_currentFrame{0};
 
+	bool m_elideState;
+	BoundState m_bound;
+
+	GpuProfiler* m_profiler{nullptr};
+	uint32_t m_frameScope{GpuProfiler::NO_SCOPE};
+
+	RenderFrameSettings m_frameSettings;
+
+	GpuCuller* m_culler{nullptr};
+
+	RenderStats m_stats{};
+	engine::TransferCounters m_transferBase{};
+
 public:
 	Renderer(const Renderer&) = delete;
 	Renderer& operator=(const Renderer&) = delete;
@@ -2,13 +2,20 @@
 
 #include <unordered_map>
 #include "scene_graph.hpp"
+#include "scene_bvh.hpp"
 #include "renderer.hpp"
+#include "render_queue.hpp"
 
 namespace etna {
 
 struct SceneRenderInfo {
 	Viewport viewport;
 	Color ambient{WHITE};
+	// draw instanceable meshes through multi-draw indirect when the device
+	// supports it
+	bool indirect{false};
+	// skip meshes whose bounds are outside the camera frustum
+	bool frustumCulling{true};
 };
 
 class Scene {
@@ -36,6 +43,31 @@ public:
 
 	void render(Renderer&, const CameraNode&, const SceneRenderInfo& = {});
 
+	// resolves the world matrices of the nodes moved since the last call, in
+	// this scene or any other; render and the queries below call it themselves
+	void updateTransforms() const;
+
+	// mesh nodes by world space bounds, see SceneBvh
+
+	std::vector<MeshNode> queryFrustum(const Frustum&) const;
+
+	std::vector<MeshNode> queryOverlap(const AABB&) const;
+
+	std::vector<MeshNode> queryOverlap(const BoundingSphere&) const;
+
+	std::vector<MeshNode> queryNearest(const Vec3&, uint32_t k) const;
+
+	// the closest triangle along the direction, which is normalized so
+	// distances are in world units; nodes with an instance buffer or a mesh
+	// created with raycast = false are skipped
+	RaycastHit raycast(
+		const Vec3& origin,
+		const Vec3& direction,
+		float maxDistance = std::numeric_limits<float>::infinity()) const;
+
+	// hits[i] for rays[i], spread across the engine worker threads
+	void raycast(std::span<const Ray> rays, std::span<RaycastHit> hits) const;
+
 public:
 	const std::unordered_map<std::string, SceneNode>& getNodes() const;
 
@@ -51,8 +83,13 @@ private:
 	void addNodeHelper(SceneNode node, const Transform& transform);
 	void updateLights();
 
-	ignis::BufferId m_sceneBuffer{IGNIS_INVALID_BUFFER_ID};
-	ignis::BufferId m_lightsBuffer{IGNIS_INVALID_BUFFER_ID};
+	// rebuilds the BVH when meshes were added or removed, refits it otherwise;
+	// updates the transforms first
+	void updateBvh() const;
+
+	std::vector<MeshNode> getBvhNodes(const std::vector<uint32_t>&) const;
+
+	engine::UniformHandle m_lightsBuffer{engine::INVALID_UNIFORM};
 
 	// PONDER: if needed provide a method to explicitly invalidate cache
 	mutable bool m_meshCacheDirty{true};
@@ -61,9 +98,18 @@ private:
 	mutable bool m_lightCacheDirty{true};
 	mutable std::vector<LightNode> m_lightCache;
 
-	struct SceneData {
+	mutable bool m_bvhDirty{true};
+	mutable SceneBvh m_bvh;
+
+	RenderQueue m_renderQueue;
+
+	// scratch of render, kept to reuse the storage
+	std::vector<uint32_t> m_visibleItems;
+
+	// aligned like the vec4 in its GLSL twin, see engine::IS_UNIFORM_BLOCK
+	struct alignas(16) SceneData {
 		Color ambient;
-		ignis::BufferId lights;
+		engine::UniformHandle lights;
 		uint32_t lightCount;
 	};
 
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <vector>
+#include "scene_graph.hpp"
+
+namespace etna {
+
+struct RaycastHit {
+	// nullptr when the ray hit nothing
+	MeshNode node;
+	// in the mesh's index buffer
+	uint32_t triangle{0};
+	// weights of the triangle's second and third vertex
+	Vec2 barycentrics{0, 0};
+	float distance{std::numeric_limits<float>::infinity()};
+};
+
+// Bounding volume hierarchy over the world space boxes of a set of mesh
+// nodes. Nodes report their moves when their world matrix is resolved, and
+// their mesh swaps through setMesh; refit only walks up from the leaves of
+// those, so a frame where a few nodes out of a million move costs a few
+// thousand box merges. Updates that change a mesh's bounds are caught by
+// comparing bounds versions, a pass over the items only after such an update.
+// The tree is built once per set of nodes; refits don't rebalance it.
+//
+// Nodes without a mesh are a point at their origin, so a mesh set later can
+// be refitted in.
+//
+// The items of every subtree are contiguous, so queries take whole subtrees
+// at once when their box is entirely inside the query volume.
+//
+// Nodes with an instance buffer have no known bounds: they are kept out of
+// the tree, always returned by frustum and overlap queries and never by
+// nearest queries or ray casts.
+class SceneBvh {
+public:
+	SceneBvh() = default;
+
+	~SceneBvh();
+
+	void build(const std::vector<MeshNode>&);
+
+	// picks up the nodes moved and the meshes changed since the last refit or
+	// build
+	void refit();
+
+	void clear();
+
+	// queries append item indices to the output, see getNode
+
+	void queryFrustum(const Frustum&, std::vector<uint32_t>& items) const;
+
+	void queryOverlap(const AABB&, std::vector<uint32_t>& items) const;
+
+	void queryOverlap(const BoundingSphere&, std::vector<uint32_t>& items) const;
+
+	// the k nodes with the closest bounds to the point, nearest first
+	void queryNearest(const Vec3&, uint32_t k, std::vector<uint32_t>& items) const;
+
+	// the closest triangle of the items with a raycastable mesh, through its
+	// triangle BVH; const, so rays can be cast from several threads between
+	// refits
+	RaycastHit raycast(const Ray&) const;
+
+	const MeshNode& getNode(uint32_t item) const { return m_items[item].node; }
+
+	const AABB& getItemBounds(uint32_t item) const { return m_items[item].bounds; }
+
+	uint32_t itemCount() const { return m_items.size(); }
+
+private:
+	friend struct _SceneNode;
+	friend struct _MeshNode;
+
+	static constexpr uint32_t MAX_LEAF_ITEMS{4};
+
+	struct Item {
+		MeshNode node;
+		AABB bounds;
+		// what the bounds were computed from
+		const Mesh* mesh{nullptr};
+		uint32_t meshVersion{0};
+		uint32_t leaf{0};
+		bool dirty{false};
+	};
+
+	// children are allocated in pairs, right = left + 1; a node without
+	// children has left = 0, which is always the root
+	struct Node {
+		AABB bounds;
+		uint32_t first{0};
+		uint32_t count{0};
+		uint32_t left{0};
+		uint32_t parent{0};
+	};
+
+	// called by the nodes on every change of their world matrix
+	void markDirty(uint32_t item);
+
+	// splits the items of a node between two new children, recursively
+	void buildNode(uint32_t index, uint32_t depth);
+
+	template <typename Volume>
+	void queryVolume(const Volume&, std::vector<uint32_t>& items) const;
+
+	std::vector<Item> m_items;
+	std::vector<Node> m_nodes;
+
+	// items [m_boundedCount, itemCount) have no bounds and no leaf
+	uint32_t m_boundedCount{0};
+
+	std::vector<uint32_t> m_dirty;
+
+	// Mesh::getBoundsEpoch at the last refit or build
+	uint64_t m_boundsEpoch{0};
+
+public:
+	SceneBvh(const SceneBvh&) = delete;
+	SceneBvh(SceneBvh&&) = delete;
+	SceneBvh& operator=(const SceneBvh&) = delete;
+	SceneBvh& operator=(SceneBvh&&) = delete;
+};
+
+}  // namespace etna
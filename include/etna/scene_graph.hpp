@@ -13,6 +13,9 @@ struct _MeshNode;
 struct _CameraNode;
 struct _LightNode;
 
+class SceneBvh;
+class TransformStore;
+
 using SceneNode = std::shared_ptr<_SceneNode>;
 using MeshNode = std::shared_ptr<_MeshNode>;
 using CameraNode = std::shared_ptr<_CameraNode>;
@@ -43,6 +46,8 @@ struct _SceneNode {
 
 	_SceneNode(Type, const std::string&, const Transform&);
 
+	~_SceneNode();
+
 	SceneNode add(SceneNode);
 
 	MeshNode createMeshNode(const CreateMeshNodeInfo&);
@@ -55,10 +60,13 @@ struct _SceneNode {
 
 	bool isRoot() const { return m_parent == nullptr; }
 
-	const Transform& getTransform() const { return m_transform; }
+	Transform getTransform() const;
 
-	Mat4 getWorldMatrix() const { return m_worldMatrix; }
+	// recomputed along the parent chain if the node or an ancestor moved
+	// since the last scene::updateWorldMatrices
+	Mat4 getWorldMatrix() const;
 
+	// edits only mark the node, see scene::updateWorldMatrices
 	void updateTransform(const Transform&);
 
 	void updatePosition(const Vec3&);
@@ -80,15 +88,24 @@ struct _SceneNode {
 #endif
 
 protected:
-	Transform m_transform;
-	Mat4 m_worldMatrix{Mat4::identity()};
+	friend class TransformStore;
+
+	// the transforms live in the TransformStore, the node keeps its id there
+	uint32_t m_transformId;
 	std::string m_name;
 	Type m_type;
 
 	_SceneNode* m_parent{nullptr};
 	std::vector<SceneNode> m_children;
 
-	void updateChildrenTransform(const Mat4&);
+	// updates what follows the node: cameras, lights and the scene BVH
+	void onWorldMatrixChanged() const;
+
+public:
+	_SceneNode(const _SceneNode&) = delete;
+	_SceneNode(_SceneNode&&) = delete;
+	_SceneNode& operator=(const _SceneNode&) = delete;
+	_SceneNode& operator=(_SceneNode&&) = delete;
 };
 
 struct _MeshNode : public _SceneNode {
@@ -96,10 +113,29 @@ struct _MeshNode : public _SceneNode {
 
 	~_MeshNode();
 
+	// swaps the mesh and refits the scene BVH item to its bounds
+	void setMesh(MeshHandle);
+
 	MaterialHandle material;
+	// read only, see setMesh
 	MeshHandle mesh;
 	ignis::BufferId instanceBuffer;
 	uint32_t instanceCount;
+
+private:
+	friend struct _SceneNode;
+	friend class SceneBvh;
+
+	struct BvhEntry {
+		SceneBvh* bvh;
+		uint32_t item;
+	};
+
+	void markBvhsDirty() const;
+
+	// one per scene BVH holding the node, as it may be in several scenes;
+	// their items are refitted when the world matrix changes
+	std::vector<BvhEntry> m_bvhEntries;
 };
 
 struct _CameraNode : public _SceneNode {
@@ -116,6 +152,13 @@ struct _LightNode : public _SceneNode {
 
 namespace scene {
 
+// resolves the world matrices of every node moved since the last call, depth
+// level by depth level across the engine workers; cameras, lights and scene
+// BVHs are told here rather than on every edit. Creating, editing and updating
+// nodes all belong to one thread, asserted in debug builds; world matrices can
+// be read from others between updates
+void updateWorldMatrices();
+
 SceneNode createRoot(const std::string&, const Transform& = {});
 
 SceneNode loadFromFile(const std::string& path);
@@ -4,9 +4,19 @@
 #define STORAGE_BUFFER_BINDING 0
 #define UNIFORM_BINDING 1
 
+// uniform blocks are suballocated from storage pages (engine::allocateUniform):
+// a handle is the page's buffer id and the block's slot in it. DEF_UBO arrays
+// are read with UNIFORM(Name, handle), not indexed by a buffer id any more
+#define UNIFORM_SLOT_BITS 12
+#define UNIFORM_SLOT_MASK ((1u << UNIFORM_SLOT_BITS) - 1u)
+
 #define DEF_UBO(Name, Struct) \
- layout(set = 0, binding = UNIFORM_BINDING) \
- uniform Name Struct u##Name[]
+ struct Name Struct; \
+ layout(std430, set = 0, binding = STORAGE_BUFFER_BINDING) \
+ readonly buffer Name##Page { Name blocks[]; } u##Name[]
+
+#define UNIFORM(Name, handle) \
+ (u##Name[(handle) >> UNIFORM_SLOT_BITS].blocks[(handle) & UNIFORM_SLOT_MASK])
 
 #define DEF_SSBO(Name, Struct) \
  layout(std430, set = 0, binding = STORAGE_BUFFER_BINDING) \
@@ -20,6 +30,7 @@ layout(push_constant) uniform constants {
 	uint buff1;
 	uint buff2;
 	uint buff3;
+	uint drawData;
 } pc;
 
 // Vertices
@@ -29,16 +40,57 @@ struct Vertex {
 	vec2 uv;
 };
 
+#define INVALID_BUFFER_ID 0xFFFFFFFFu
+
+// Draw records: set for draws the renderer merged into instanced or indirect
+// ones, each instance then has its own model, mesh and material. Vertex
+// shaders of templates with autoInstancing read MODEL and V and call
+// FORWARD_DRAW_DATA() so the fragment stage gets the right MATERIAL.
+struct DrawRecord {
+	mat4 model;
+	uint material;
+	uint vertices;
+};
+
+DEF_SSBO(DrawData, {
+	DrawRecord draws[];
+});
+
+#define HAS_DRAW_DATA (pc.drawData != INVALID_BUFFER_ID)
+
+#define DRAW (bDrawData[pc.drawData].draws[gl_InstanceIndex])
+
+#define MODEL (HAS_DRAW_DATA ? DRAW.model : pc.model)
+
 DEF_SSBO(VertexBuffer, {
 	Vertex vertices[];
 });
 
-#define V (bVertexBuffer[pc.vertices].vertices[gl_VertexIndex])
+#define VERTEX_BUFFER (HAS_DRAW_DATA ? DRAW.vertices : pc.vertices)
+
+#define V (bVertexBuffer[VERTEX_BUFFER].vertices[gl_VertexIndex])
+
+// the stage defines come from compile_shaders
+#define DRAW_MATERIAL_LOCATION 15
+
+#if defined(ETNA_VERTEX_SHADER)
+layout(location = DRAW_MATERIAL_LOCATION) flat out uint etnaDrawMaterial;
+
+#define MATERIAL_HANDLE (HAS_DRAW_DATA ? DRAW.material : pc.material)
+
+#define FORWARD_DRAW_DATA() etnaDrawMaterial = MATERIAL_HANDLE
+#elif defined(ETNA_FRAGMENT_SHADER)
+layout(location = DRAW_MATERIAL_LOCATION) flat in uint etnaDrawMaterial;
+
+#define MATERIAL_HANDLE (HAS_DRAW_DATA ? etnaDrawMaterial : pc.material)
+#else
+#define MATERIAL_HANDLE (pc.material)
+#endif
 
 // Material
 #define DEF_MATERIAL(Struct) DEF_UBO(Material, Struct)
 
-#define MATERIAL (uMaterial[pc.material])
+#define MATERIAL UNIFORM(Material, MATERIAL_HANDLE)
 
 // Instanced
 #define DEF_INSTANCE_DATA(Struct) \
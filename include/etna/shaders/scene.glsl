@@ -14,13 +14,13 @@ DEF_UBO(SceneData, {
 	uint lightCount;
 });
 
-#define SCENE (uSceneData[pc.buff1])
+#define SCENE UNIFORM(SceneData, pc.buff1)
 
-#define CAMERA (uCameraData[pc.buff2])
+#define CAMERA UNIFORM(CameraData, pc.buff2)
 
-#define LIGHTS (uSceneLights[SCENE.lightsBuffer])
+#define LIGHTS UNIFORM(SceneLights, SCENE.lightsBuffer)
 
-#define LIGHT(i) (uDirectionalLights[LIGHTS.lights[i]])
+#define LIGHT(i) UNIFORM(DirectionalLights, LIGHTS.lights[i])
 
 #define AMBIENT (SCENE.ambientColor)
 
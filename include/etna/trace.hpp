@@ -0,0 +1,74 @@
+#pragma once
+
+// CPU scope tracing. Unless the library is built with -DETNA_TRACING=ON the
+// macros expand to nothing and none of this is compiled in.
+//
+//   void update() {
+//       ETNA_TRACE_FUNCTION();
+//       ...
+//       { ETNA_TRACE_SCOPE("physics"); ... }
+//   }
+//
+// Every thread records into its own lock-free ring, keeping the most recent
+// events; ETNA_TRACE_WRITE(path) dumps all of them as Chrome trace JSON,
+// which Perfetto also loads.
+
+#ifdef ETNA_TRACING
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace etna::trace {
+
+// name must outlive the trace, string literals and __func__ do
+void record(const char* name, uint64_t startNs, uint64_t endNs);
+
+inline uint64_t now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			   std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+void setThreadName(const std::string& name);
+
+// snapshot of every thread's ring; recording may continue meanwhile
+void write(const std::string& path);
+
+class Scope {
+public:
+	Scope(const char* name) : m_name(name), m_start(now()) {}
+
+	~Scope() { record(m_name, m_start, now()); }
+
+private:
+	const char* m_name;
+	uint64_t m_start;
+
+public:
+	Scope(const Scope&) = delete;
+	Scope& operator=(const Scope&) = delete;
+};
+
+}  // namespace etna::trace
+
+#define ETNA_TRACE_CONCAT_(a, b) a##b
+#define ETNA_TRACE_CONCAT(a, b) ETNA_TRACE_CONCAT_(a, b)
+
+#define ETNA_TRACE_SCOPE(name) \
+	::etna::trace::Scope ETNA_TRACE_CONCAT(_etnaTraceScope, __LINE__)(name)
+
+#define ETNA_TRACE_FUNCTION() ETNA_TRACE_SCOPE(__func__)
+
+#define ETNA_TRACE_THREAD(name) ::etna::trace::setThreadName(name)
+
+#define ETNA_TRACE_WRITE(path) ::etna::trace::write(path)
+
+#else
+
+#define ETNA_TRACE_SCOPE(name)
+#define ETNA_TRACE_FUNCTION()
+#define ETNA_TRACE_THREAD(name)
+#define ETNA_TRACE_WRITE(path)
+
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <span>
+#include <vector>
+#include "bounds.hpp"
+
+namespace etna {
+
+struct TriangleHit {
+	// in the index buffer the tree was built from
+	uint32_t triangle{0};
+	float distance{std::numeric_limits<float>::infinity()};
+	// weights of the triangle's second and third vertex
+	float u{0};
+	float v{0};
+};
+
+// Bounding volume hierarchy over the triangles of a mesh, for ray casts on
+// the CPU. Built with binned SAH; nodes are 32 bytes, children allocated in
+// pairs and leaves point into triangles stored in tree order, so a traversal
+// touches few cache lines.
+class TriangleBvh {
+public:
+	TriangleBvh(std::span<const Vec3> positions, std::span<const uint32_t> indices);
+
+	// the direction needs not be unit length, distances are in its units;
+	// updates hit only with a closer triangle than the ray's maxDistance
+	bool raycast(const Ray&, TriangleHit&) const;
+
+	uint32_t triangleCount() const { return m_triangles.size(); }
+
+private:
+	struct Node {
+		AABB bounds;
+		// the left child, right = first + 1, or the first triangle of a leaf
+		uint32_t first{0};
+		// 0 for nodes with children
+		uint32_t count{0};
+	};
+
+	static_assert(sizeof(Node) == 32);
+
+	// the vertex and edges Moller-Trumbore reads, precomputed
+	struct Triangle {
+		Vec3 v0;
+		Vec3 e1;
+		Vec3 e2;
+	};
+
+	struct BuildTriangle {
+		AABB bounds;
+		Vec3 center;
+		uint32_t id;
+	};
+
+	void buildNode(uint32_t index, std::vector<BuildTriangle>&, uint32_t depth);
+
+	std::vector<Node> m_nodes;
+	std::vector<Triangle> m_triangles;
+	std::vector<uint32_t> m_ids;
+};
+
+}  // namespace etna
@@ -2,8 +2,10 @@
 
 #include <unordered_map>
 #include "ignis/swapchain.hpp"
+#include "ignis/fence.hpp"
 #include "render_target.hpp"
 #include "key_map.hpp"
+#include "gpu_profiler.hpp"
 
 struct GLFWwindow;
 
@@ -16,6 +18,7 @@ public:
 		uint32_t height{0};
 		const char* title{"Etna Window"};
 		bool captureMouse{false};
+		uint32_t framesInFlight{2};
 	};
 
 	Window(const CreateInfo&);
@@ -23,7 +26,8 @@ public:
 	~Window();
 
 	void pollEvents();
-	void swapBuffers();
+	// the blit is recorded as a "blit" scope when a profiler is passed
+	void swapBuffers(GpuProfiler* profiler = nullptr);
 
 	bool shouldClose() const;
 	bool isKeyPressed(Key) const;
@@ -51,9 +55,16 @@ private:
 
 	std::unordered_map<int, bool> m_prevKeyStates;
 
-	ignis::Command* m_blitCmd;
-	ignis::Semaphore* m_imageAvailable;
-	ignis::Semaphore* m_finishedBlitting;
+	struct BlitFrame {
+		ignis::Command* cmd;
+		ignis::Fence* inFlight;
+		ignis::Semaphore* imageAvailable;
+		ignis::Semaphore* finishedBlitting;
+		bool submitted{false};
+	};
+
+	std::vector<BlitFrame> m_blitFrames;
+	uint32_t m_currentFrame{0};
 
 public:
 	Window(const Window&) = delete;
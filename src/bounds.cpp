@@ -0,0 +1,175 @@
+#include <algorithm>
+#include "etna/bounds.hpp"
+
+using namespace etna;
+
+static Vec3 transformPoint(const Mat4& M, const Vec3& p) {
+	return {
+		M(0, 0) * p[0] + M(0, 1) * p[1] + M(0, 2) * p[2] + M(0, 3),
+		M(1, 0) * p[0] + M(1, 1) * p[1] + M(1, 2) * p[2] + M(1, 3),
+		M(2, 0) * p[0] + M(2, 1) * p[1] + M(2, 2) * p[2] + M(2, 3),
+	};
+}
+
+AABB AABB::transform(const Mat4& M) const {
+	const Vec3 c = transformPoint(M, center());
+	const Vec3 e = extent();
+
+	Vec3 newExtent{0, 0, 0};
+
+	for (uint32_t i{0}; i < 3; i++) {
+		newExtent[i] = std::abs(M(i, 0)) * e[0] + std::abs(M(i, 1)) * e[1] +
+					   std::abs(M(i, 2)) * e[2];
+	}
+
+	return {
+		.min = c - newExtent,
+		.max = c + newExtent,
+	};
+}
+
+void AABB::merge(const AABB& other) {
+	for (uint32_t i{0}; i < 3; i++) {
+		min[i] = std::min(min[i], other.min[i]);
+		max[i] = std::max(max[i], other.max[i]);
+	}
+}
+
+bool AABB::overlaps(const AABB& other) const {
+	for (uint32_t i{0}; i < 3; i++) {
+		if (min[i] > other.max[i] || max[i] < other.min[i]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool AABB::contains(const AABB& other) const {
+	for (uint32_t i{0}; i < 3; i++) {
+		if (other.min[i] < min[i] || other.max[i] > max[i]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+float AABB::distance2(const Vec3& p) const {
+	float distance{0};
+
+	for (uint32_t i{0}; i < 3; i++) {
+		const float d = std::max({min[i] - p[i], 0.f, p[i] - max[i]});
+		distance += d * d;
+	}
+
+	return distance;
+}
+
+float AABB::surfaceArea() const {
+	const Vec3 size = max - min;
+
+	return 2 * (size[0] * size[1] + size[1] * size[2] + size[2] * size[0]);
+}
+
+BoundingSphere BoundingSphere::transform(const Mat4& M) const {
+	float maxScale{0};
+
+	for (uint32_t col{0}; col < 3; col++) {
+		maxScale = std::max(maxScale, square(M(0, col)) + square(M(1, col)) +
+										  square(M(2, col)));
+	}
+
+	return {
+		.center = transformPoint(M, center),
+		.radius = radius * std::sqrt(maxScale),
+	};
+}
+
+bool BoundingSphere::overlaps(const AABB& box) const {
+	return box.distance2(center) <= radius * radius;
+}
+
+bool BoundingSphere::contains(const AABB& box) const {
+	float farthest{0};
+
+	for (uint32_t i{0}; i < 3; i++) {
+		const float d = std::max(std::abs(box.min[i] - center[i]),
+								 std::abs(box.max[i] - center[i]));
+		farthest += d * d;
+	}
+
+	return farthest <= radius * radius;
+}
+
+Frustum Frustum::fromMatrix(const Mat4& M) {
+	Frustum frustum;
+
+	// left, right, bottom, top, near, far; clip z is in [-w, w]
+	for (uint32_t i{0}; i < 6; i++) {
+		const uint32_t row = i / 2;
+		const float sign = i % 2 == 0 ? 1.f : -1.f;
+
+		Vec4 plane(0.f);
+
+		for (uint32_t col{0}; col < 4; col++) {
+			plane[col] = M(3, col) + sign * M(row, col);
+		}
+
+		const float length =
+			std::sqrt(square(plane[0]) + square(plane[1]) + square(plane[2]));
+
+		frustum.planes[i] = length > 0 ? Vec4(plane / length) : plane;
+	}
+
+	return frustum;
+}
+
+bool Frustum::intersects(const BoundingSphere& sphere) const {
+	for (const Vec4& p : planes) {
+		const float distance = p[0] * sphere.center[0] + p[1] * sphere.center[1] +
+							   p[2] * sphere.center[2] + p[3];
+
+		if (distance < -sphere.radius) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Frustum::intersects(const AABB& box) const {
+	const Vec3 c = box.center();
+	const Vec3 e = box.extent();
+
+	for (const Vec4& p : planes) {
+		const float distance = p[0] * c[0] + p[1] * c[1] + p[2] * c[2] + p[3];
+
+		const float reach = std::abs(p[0]) * e[0] + std::abs(p[1]) * e[1] +
+							std::abs(p[2]) * e[2];
+
+		if (distance < -reach) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Frustum::contains(const AABB& box) const {
+	const Vec3 c = box.center();
+	const Vec3 e = box.extent();
+
+	for (const Vec4& p : planes) {
+		const float distance = p[0] * c[0] + p[1] * c[1] + p[2] * c[2] + p[3];
+
+		const float reach = std::abs(p[0]) * e[0] + std::abs(p[1]) * e[1] +
+							std::abs(p[2]) * e[2];
+
+		if (distance < reach) {
+			return false;
+		}
+	}
+
+	return true;
+}
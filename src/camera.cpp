@@ -1,5 +1,6 @@
 #include "etna/camera.hpp"
 #include "etna/engine.hpp"
+#include "etna/trace.hpp"
 
 using namespace etna;
 
@@ -48,11 +49,12 @@ Camera::Camera(const CreateInfo& info)
 		.proj = m_projMatrix,
 	};
 
-	m_cameraData = _device.createUBO(sizeof(CameraData), &cameraData);
+	m_cameraData = engine::allocateUniform(cameraData,
+										   engine::MemoryCategory::OBJECT_UBO);
 }
 
 Camera::~Camera() {
-	_device.destroyBuffer(m_cameraData);
+	engine::freeUniform(m_cameraData, engine::MemoryCategory::OBJECT_UBO);
 }
 
 void Camera::updateTransform(const Transform& transform) {
@@ -60,6 +62,8 @@ void Camera::updateTransform(const Transform& transform) {
 }
 
 void Camera::updateTransform(const Mat4& transform) {
+	ETNA_TRACE_SCOPE("Camera::updateTransform");
+
 	if (transform == m_worldMatrix)
 		return;
 
@@ -72,10 +76,12 @@ void Camera::updateTransform(const Mat4& transform) {
 		.proj = m_projMatrix,
 	};
 
-	_device.updateBuffer(m_cameraData, &cameraData);
+	engine::updateUniform(m_cameraData, cameraData);
 }
 
 void Camera::updateFov(float fov) {
+	ETNA_TRACE_SCOPE("Camera::updateFov");
+
 	if (fov == m_fov)
 		return;
 
@@ -88,10 +94,12 @@ void Camera::updateFov(float fov) {
 		.proj = m_projMatrix,
 	};
 
-	_device.updateBuffer(m_cameraData, &cameraData);
+	engine::updateUniform(m_cameraData, cameraData);
 }
 
 void Camera::updateAspect(float aspect) {
+	ETNA_TRACE_SCOPE("Camera::updateAspect");
+
 	if (aspect == m_aspect)
 		return;
 
@@ -104,10 +112,12 @@ void Camera::updateAspect(float aspect) {
 		.proj = m_projMatrix,
 	};
 
-	_device.updateBuffer(m_cameraData, &cameraData);
+	engine::updateUniform(m_cameraData, cameraData);
 }
 
 void Camera::updateNear(float near) {
+	ETNA_TRACE_SCOPE("Camera::updateNear");
+
 	if (near == m_near)
 		return;
 
@@ -120,10 +130,12 @@ void Camera::updateNear(float near) {
 		.proj = m_projMatrix,
 	};
 
-	_device.updateBuffer(m_cameraData, &cameraData);
+	engine::updateUniform(m_cameraData, cameraData);
 }
 
 void Camera::updateFar(float far) {
+	ETNA_TRACE_SCOPE("Camera::updateFar");
+
 	if (far == m_far)
 		return;
 
@@ -136,5 +148,5 @@ void Camera::updateFar(float far) {
 		.proj = m_projMatrix,
 	};
 
-	_device.updateBuffer(m_cameraData, &cameraData);
+	engine::updateUniform(m_cameraData, cameraData);
 }
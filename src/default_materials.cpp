@@ -1,6 +1,9 @@
+#include <stdexcept>
 #include "etna/default_materials.hpp"
 #include "etna/engine.hpp"
+#ifndef ETNA_SHADER_ARCHIVE
 #include "incbin.h"
+#endif
 
 using namespace etna;
 
@@ -11,12 +14,50 @@ MaterialTemplateHandle g_pointMaterialTemplate{nullptr};
 MaterialTemplateHandle g_gridTemplate{nullptr};
 MaterialTemplateHandle g_transparentGridTemplate{nullptr};
 
+MaterialHandle g_fallbackMaterial{nullptr};
+
+}
+
+#ifdef ETNA_SHADER_ARCHIVE
+
+static RawShader archivedShader(const char* name, VkShaderStageFlagBits stage) {
+	const auto code = engine::getArchivedShader(name);
+
+	if (code.empty()) {
+		throw std::runtime_error(std::string("missing archived shader ") + name);
+	}
+
+	return {code.data(), code.size(), stage};
+}
+
+RawShader engine::getDefaultVertShader() {
+	return archivedShader("default.vert", VK_SHADER_STAGE_VERTEX_BIT);
+}
+
+RawShader engine::getDefaultFragShader() {
+	return archivedShader("default.frag", VK_SHADER_STAGE_FRAGMENT_BIT);
+}
+
+RawShader engine::getGridFragShader() {
+	return archivedShader("grid.frag", VK_SHADER_STAGE_FRAGMENT_BIT);
 }
 
+RawShader engine::getCullCompShader() {
+	return archivedShader("cull.comp", VK_SHADER_STAGE_COMPUTE_BIT);
+}
+
+RawShader engine::getHiZCompShader() {
+	return archivedShader("hiz.comp", VK_SHADER_STAGE_COMPUTE_BIT);
+}
+
+#else
+
 // TEMP: look at incbin.h
 EMBED_BINARY(g_default_vert_spv, "src/shaders/default.vert.spv");
 EMBED_BINARY(g_default_frag_spv, "src/shaders/default.frag.spv");
 EMBED_BINARY(g_grid_frag_spv, "src/shaders/grid.frag.spv");
+EMBED_BINARY(g_cull_comp_spv, "src/shaders/cull.comp.spv");
+EMBED_BINARY(g_hiz_comp_spv, "src/shaders/hiz.comp.spv");
 
 const RawShader g_default_vert{
 	g_default_vert_spv,
@@ -36,6 +77,18 @@ const RawShader g_grid_frag{
 	VK_SHADER_STAGE_FRAGMENT_BIT,
 };
 
+const RawShader g_cull_comp{
+	g_cull_comp_spv,
+	g_cull_comp_spv_size,
+	VK_SHADER_STAGE_COMPUTE_BIT,
+};
+
+const RawShader g_hiz_comp{
+	g_hiz_comp_spv,
+	g_hiz_comp_spv_size,
+	VK_SHADER_STAGE_COMPUTE_BIT,
+};
+
 RawShader engine::getDefaultVertShader() {
 	return g_default_vert;
 }
@@ -48,6 +101,16 @@ RawShader engine::getGridFragShader() {
 	return g_grid_frag;
 }
 
+RawShader engine::getCullCompShader() {
+	return g_cull_comp;
+}
+
+RawShader engine::getHiZCompShader() {
+	return g_hiz_comp;
+}
+
+#endif
+
 MaterialHandle engine::createColorMaterial(Color color) {
 	initColorMaterial();
 
@@ -88,59 +151,110 @@ MaterialHandle engine::createTransparentGridMaterial(GridMaterialParams params)
 	});
 }
 
-void engine::initDefaultMaterials() {
-	initColorMaterial();
-	initPointMaterial();
-	initGridMaterial();
-	initTransparentGridMaterial();
+MaterialHandle engine::getFallbackMaterial() {
+	if (g_fallbackMaterial == nullptr) {
+		setFallbackMaterial(createColorMaterial(WHITE * 0.5f));
+	}
+
+	return g_fallbackMaterial;
 }
 
-void engine::initColorMaterial() {
+void engine::setFallbackMaterial(MaterialHandle material) {
+	assert(material != nullptr);
+
+	if (g_fallbackMaterial == nullptr) {
+		queueForDeletion([=] { g_fallbackMaterial.reset(); });
+	}
+
+	g_fallbackMaterial = material;
+	g_fallbackMaterial->getTemplate().waitReady();
+}
+
+static void initColorTemplate(bool async) {
 	if (g_colorMaterialTemplate != nullptr) {
 		return;
 	}
 
 	g_colorMaterialTemplate = MaterialTemplate::create({
-		.rawShaders = {g_default_vert, g_default_frag},
+		.rawShaders = {engine::getDefaultVertShader(),
+					   engine::getDefaultFragShader()},
+		.async = async,
+		.autoInstancing = true,
 	});
 
-	queueForDeletion([=] { g_colorMaterialTemplate.reset(); });
+	engine::queueForDeletion([=] { g_colorMaterialTemplate.reset(); });
 }
 
-void engine::initPointMaterial() {
+static void initPointTemplate(bool async) {
 	if (g_pointMaterialTemplate != nullptr) {
 		return;
 	}
 
 	g_pointMaterialTemplate = MaterialTemplate::create({
-		.rawShaders = {g_default_vert, g_default_frag},
+		.rawShaders = {engine::getDefaultVertShader(),
+					   engine::getDefaultFragShader()},
 		.polygonMode = VK_POLYGON_MODE_POINT,
+		.async = async,
+		.autoInstancing = true,
 	});
 
-	queueForDeletion([=] { g_pointMaterialTemplate.reset(); });
+	engine::queueForDeletion([=] { g_pointMaterialTemplate.reset(); });
 }
 
-void engine::initGridMaterial() {
+static void initGridTemplate(bool async) {
 	if (g_gridTemplate != nullptr) {
 		return;
 	}
 
 	g_gridTemplate = MaterialTemplate::create({
-		.rawShaders = {g_default_vert, g_grid_frag},
+		.rawShaders = {engine::getDefaultVertShader(), engine::getGridFragShader()},
+		.async = async,
+		.autoInstancing = true,
 	});
 
-	queueForDeletion([=] { g_gridTemplate.reset(); });
+	engine::queueForDeletion([=] { g_gridTemplate.reset(); });
 }
 
-void engine::initTransparentGridMaterial() {
+static void initTransparentGridTemplate(bool async) {
 	if (g_transparentGridTemplate != nullptr) {
 		return;
 	}
 
 	g_transparentGridTemplate = MaterialTemplate::create({
-		.rawShaders = {g_default_vert, g_grid_frag},
+		.rawShaders = {engine::getDefaultVertShader(), engine::getGridFragShader()},
 		.transparency = true,
+		.async = async,
+		.autoInstancing = true,
 	});
 
-	queueForDeletion([=] { g_transparentGridTemplate.reset(); });
+	engine::queueForDeletion([=] { g_transparentGridTemplate.reset(); });
+}
+
+// the four compile on the workers at once
+void engine::initDefaultMaterials() {
+	initColorTemplate(true);
+	initPointTemplate(true);
+	initGridTemplate(true);
+	initTransparentGridTemplate(true);
+
+	g_colorMaterialTemplate->waitReady();
+	g_pointMaterialTemplate->waitReady();
+	g_gridTemplate->waitReady();
+	g_transparentGridTemplate->waitReady();
+}
+
+void engine::initColorMaterial() {
+	initColorTemplate(false);
+}
+
+void engine::initPointMaterial() {
+	initPointTemplate(false);
+}
+
+void engine::initGridMaterial() {
+	initGridTemplate(false);
+}
+
+void engine::initTransparentGridMaterial() {
+	initTransparentGridTemplate(false);
 }
@@ -1,8 +1,23 @@
 #include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <sstream>
+#include <unordered_map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
 #include "GLFW/glfw3.h"
 #include "ignis/device.hpp"
 #include "ignis/command.hpp"
 #include "etna/engine.hpp"
+#include "etna/trace.hpp"
+#include "thread_pool.hpp"
+#include "stats.hpp"
 
 using namespace etna;
 using namespace ignis;
@@ -12,54 +27,379 @@ namespace {
 Device* g_device{nullptr};
 VkQueue g_graphicsQueue{nullptr};
 VkQueue g_immediateQueue{nullptr};
+VkQueue g_uploadQueue{nullptr};
 VkQueue g_presentQueue{nullptr};
-float g_deltaTime{0};
+Fence* g_immediateFence{nullptr};
+bool g_headless{false};
+std::string g_frameReportPath;
+engine::TransferCounters g_transferCounters{};
 std::string g_shadersFolder;
 std::deque<std::function<void()>> g_deletionQueue;
 
+struct RetiredResource {
+	engine::CompletionToken token;
+	std::function<void()> destroy;
+};
+
+engine::CompletionToken g_lastToken{0};
+engine::CompletionToken g_completedToken{0};
+uint32_t g_recordingFrames{0};
+std::deque<RetiredResource> g_retireQueue;
+std::vector<std::function<void()>> g_pendingRetire;
+
+VkPipelineCache g_pipelineCache{VK_NULL_HANDLE};
+std::string g_pipelineCachePath;
+
+// prepended to the driver blob so that a cache written by another
+// device or driver version is discarded before reaching the driver
+struct PipelineCacheHeader {
+	uint32_t magic;
+	uint32_t vendorID;
+	uint32_t deviceID;
+	uint32_t driverVersion;
+	uint8_t uuid[VK_UUID_SIZE];
+	uint64_t dataSize;
+};
+
+constexpr uint32_t PIPELINE_CACHE_MAGIC{0x43505445};  // "ETPC"
+
+struct ShaderArchive {
+	void* data;
+	size_t size;
+	std::unordered_map<std::string, std::span<const unsigned char>> entries;
+};
+
+std::vector<ShaderArchive> g_shaderArchives;
+// the code is kept to tell apart modules whose hashes collide
+struct CachedShader {
+	VkShaderStageFlagBits stage;
+	std::vector<unsigned char> code;
+	std::weak_ptr<Shader> shader;
+};
+
+std::unordered_multimap<uint64_t, CachedShader> g_shaderCache;
+
+ThreadPool* g_threadPool{nullptr};
+
 }
 
 #define CHECK_INIT assert(g_device != nullptr && "Engine not initialized");
 
+static PipelineCacheHeader currentCacheHeader() {
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(g_device->getPhysicalDevice(), &props);
+
+	PipelineCacheHeader header{
+		.magic = PIPELINE_CACHE_MAGIC,
+		.vendorID = props.vendorID,
+		.deviceID = props.deviceID,
+		.driverVersion = props.driverVersion,
+	};
+
+	std::memcpy(header.uuid, props.pipelineCacheUUID, VK_UUID_SIZE);
+
+	return header;
+}
+
+static std::vector<char> readPipelineCache(const std::string& path) {
+	std::ifstream file(path, std::ios::binary);
+
+	if (!file) {
+		return {};
+	}
+
+	PipelineCacheHeader header{};
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+	const PipelineCacheHeader expected = currentCacheHeader();
+
+	if (!file || header.magic != expected.magic ||
+		header.vendorID != expected.vendorID ||
+		header.deviceID != expected.deviceID ||
+		header.driverVersion != expected.driverVersion ||
+		std::memcmp(header.uuid, expected.uuid, VK_UUID_SIZE) != 0) {
+		return {};
+	}
+
+	// a truncated or corrupt file is a miss, not a huge allocation
+	const std::streampos dataStart = file.tellg();
+	file.seekg(0, std::ios::end);
+	const std::streamoff remaining = file.tellg() - dataStart;
+	file.seekg(dataStart);
+
+	if (!file || remaining < 0 ||
+		header.dataSize != static_cast<uint64_t>(remaining)) {
+		return {};
+	}
+
+	std::vector<char> data(header.dataSize);
+	file.read(data.data(), static_cast<std::streamsize>(data.size()));
+
+	if (!file) {
+		return {};
+	}
+
+	return data;
+}
+
+// archive layout (see cmake/PackShaders.cmake):
+//   ETNAPAK1\n<count>\n<name> <offset> <size>\n... then the blobs, 4-byte aligned
+static void mapShaderArchive(const std::string& path) {
+	const int fd = open(path.c_str(), O_RDONLY);
+
+	if (fd < 0) {
+		throw std::runtime_error("failed to open shader archive " + path);
+	}
+
+	struct stat st {};
+	fstat(fd, &st);
+
+	const size_t size = static_cast<size_t>(st.st_size);
+	void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		throw std::runtime_error("failed to map shader archive " + path);
+	}
+
+	const unsigned char* base = static_cast<const unsigned char*>(data);
+	const char* cursor = static_cast<const char*>(data);
+	const char* end = cursor + size;
+
+	auto fail = [&]() {
+		munmap(data, size);
+		throw std::runtime_error("invalid shader archive " + path);
+	};
+
+	auto nextLine = [&]() {
+		const void* newline = std::memchr(cursor, '\n', end - cursor);
+
+		if (newline == nullptr) {
+			fail();
+		}
+
+		std::string line(cursor, static_cast<const char*>(newline));
+		cursor = static_cast<const char*>(newline) + 1;
+		return line;
+	};
+
+	if (nextLine() != "ETNAPAK1") {
+		fail();
+	}
+
+	const uint32_t count = std::stoul(nextLine());
+
+	struct Entry {
+		std::string name;
+		size_t offset{0};
+		size_t size{0};
+	};
+
+	std::vector<Entry> entries(count);
+
+	for (Entry& entry : entries) {
+		std::istringstream(nextLine()) >> entry.name >> entry.offset >> entry.size;
+	}
+
+	const size_t dataStart =
+		(static_cast<size_t>(cursor - static_cast<const char*>(data)) + 3) &
+		~size_t(3);
+
+	ShaderArchive archive{.data = data, .size = size};
+
+	for (const Entry& entry : entries) {
+		if (dataStart + entry.offset + entry.size > size) {
+			fail();
+		}
+
+		archive.entries[entry.name] = {base + dataStart + entry.offset, entry.size};
+	}
+
+	g_shaderArchives.push_back(std::move(archive));
+}
+
+#ifdef ETNA_SHADER_ARCHIVE
+
+// next to the executable first, so installed or moved binaries find it; the
+// build tree's copy otherwise
+static std::string findEngineArchive(const std::string& configured) {
+	if (!configured.empty()) {
+		return configured;
+	}
+
+	std::error_code error;
+	const auto executable = std::filesystem::read_symlink("/proc/self/exe", error);
+
+	if (!error) {
+		const auto local = executable.parent_path() / "src.pak";
+
+		if (std::filesystem::exists(local, error)) {
+			return local.string();
+		}
+	}
+
+	return ETNA_SHADER_ARCHIVE;
+}
+
+#endif
+
+static void unmapShaderArchives() {
+	for (const ShaderArchive& archive : g_shaderArchives) {
+		munmap(archive.data, archive.size);
+	}
+
+	g_shaderArchives.clear();
+}
+
+static void initPipelineCache(const std::string& path) {
+	g_pipelineCachePath = path;
+
+	const std::vector<char> data =
+		path.empty() ? std::vector<char>{} : readPipelineCache(path);
+
+	// internally synchronized (no EXTERNALLY_SYNCHRONIZED flag), so async
+	// material templates can build their pipelines on the workers
+	const VkPipelineCacheCreateInfo createInfo{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		.initialDataSize = data.size(),
+		.pInitialData = data.empty() ? nullptr : data.data(),
+	};
+
+	if (vkCreatePipelineCache(g_device->getDevice(), &createInfo, nullptr,
+							  &g_pipelineCache) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create pipeline cache!");
+	}
+}
+
+static void savePipelineCache() {
+	if (g_pipelineCachePath.empty()) {
+		return;
+	}
+
+	size_t size{0};
+	vkGetPipelineCacheData(g_device->getDevice(), g_pipelineCache, &size, nullptr);
+
+	std::vector<char> data(size);
+	if (vkGetPipelineCacheData(g_device->getDevice(), g_pipelineCache, &size,
+							   data.data()) != VK_SUCCESS) {
+		return;
+	}
+
+	PipelineCacheHeader header = currentCacheHeader();
+	header.dataSize = size;
+
+	std::ofstream file(g_pipelineCachePath, std::ios::binary | std::ios::trunc);
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(data.data(), static_cast<std::streamsize>(size));
+}
+
 static void cleanup() {
 	g_device->waitIdle();
 
-	glfwTerminate();
+	if (!g_headless) {
+		glfwTerminate();
+	}
+
+	// an exception escaping an atexit handler terminates the process before
+	// the device is released, so a failed report is only logged
+	if (!g_frameReportPath.empty()) {
+		try {
+			engine::writeFrameTimeReport(g_frameReportPath);
+		} catch (const std::exception& e) {
+			std::cerr << "etna: frame time report: " << e.what() << std::endl;
+		}
+	}
 
 	for (auto& func : g_deletionQueue) {
 		func();
 	}
 
+	delete g_threadPool;
+
+	// the device is idle, everything queued so far can go
+	g_recordingFrames = 0;
+	engine::endFrameRecording(g_lastToken);
+	engine::signalToken(g_lastToken);
+	engine::retireResources();
+
+	savePipelineCache();
+	vkDestroyPipelineCache(g_device->getDevice(), g_pipelineCache, nullptr);
+
+	unmapShaderArchives();
+
+	delete g_immediateFence;
+
 	delete g_device;
 }
 
 void engine::init(const InitInfo& info) {
-	glfwInit();
+	g_headless = info.headless;
+
+	std::vector<const char*> extensions;
+	std::vector<const char*> instanceExtensions;
+
+	// headless nodes have no display server, so stay away from GLFW and the
+	// surface extensions entirely
+	if (!g_headless) {
+		glfwInit();
 
-	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions =
-		glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+		uint32_t glfwExtensionCount = 0;
+		const char** glfwExtensions =
+			glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-	std::vector<const char*> extensions(glfwExtensions,
-										glfwExtensions + glfwExtensionCount);
+		instanceExtensions.assign(glfwExtensions,
+								  glfwExtensions + glfwExtensionCount);
+
+		extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+	}
 
 	g_device = new ignis::Device({
 		.appName = info.appName,
-		.extensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME},
-		.instanceExtensions = extensions,
-		.optionalFeatures = {"FillModeNonSolid", "SampleRateShading"},
+		.extensions = extensions,
+		.instanceExtensions = instanceExtensions,
+		.optionalFeatures = {"FillModeNonSolid", "SampleRateShading",
+							 "MultiDrawIndirect", "DrawIndirectFirstInstance",
+							 "DrawIndirectCount"},
 	});
 
-	// TODO: choose graphics & upload queues
+	// ignis only exposes queues from the graphics family, so uploads share
+	// the graphics queue; they are still batched and fence-tracked
 	g_graphicsQueue = g_device->getQueue(0);
 	g_immediateQueue = g_device->getQueue(0);
+	g_uploadQueue = g_device->getQueue(0);
 	g_presentQueue = g_device->getQueue(0);
 
+	g_immediateFence = new Fence(g_device->createFence());
+
+	initPipelineCache(info.pipelineCachePath);
+
+#ifdef ETNA_SHADER_ARCHIVE
+	mapShaderArchive(findEngineArchive(info.engineShaderArchive));
+#endif
+
+	for (const auto& archive : info.shaderArchives) {
+		mapShaderArchive(archive);
+	}
+
 	g_shadersFolder = info.shadersFolder;
+	g_frameReportPath = info.frameReportPath;
+
+	const uint32_t workerThreads =
+		info.workerThreads
+			? info.workerThreads
+			: std::max(2u, std::thread::hardware_concurrency()) - 1;
+
+	g_threadPool = new ThreadPool(workerThreads);
 
 	std::atexit(cleanup);
 }
 
+bool engine::isHeadless() {
+	return g_headless;
+}
+
 Device& engine::getDevice() {
 	CHECK_INIT;
 
@@ -69,9 +409,13 @@ Device& engine::getDevice() {
 void engine::immediateSubmit(std::function<void(ignis::Command&)>&& func) {
 	CHECK_INIT;
 
+	ETNA_TRACE_SCOPE("engine::immediateSubmit");
+
+	ETNA_STAT(g_transferCounters.immediateSubmits++);
+
 	Command cmd{{
 		.device = *g_device,
-		.queue = g_graphicsQueue,
+		.queue = g_immediateQueue,
 	}};
 
 	cmd.begin();
@@ -80,16 +424,31 @@ void engine::immediateSubmit(std::function<void(ignis::Command&)>&& func) {
 
 	cmd.end();
 
-	g_device->submitCommands({{.command = cmd}}, nullptr);
-	g_device->waitIdle();
+	flushUploads();
+
+	const CompletionToken token = nextToken();
+
+	g_device->submitCommands({{.command = cmd}}, g_immediateFence);
+
+	// wait for this submission only instead of draining the device
+	engine::waitFence(*g_immediateFence);
+	g_immediateFence->reset();
+
+	signalToken(token);
 }
 
-void engine::immediateUpdate(ignis::BufferId buffer,
+void engine::immediateUpload(ignis::BufferId buffer,
 							 const void* data,
 							 VkDeviceSize offset,
 							 VkDeviceSize size) {
-	immediateSubmit(
-		[&](ignis::Command& cmd) { cmd.updateBuffer(buffer, data, offset, size); });
+	waitFor(upload(buffer, data, offset, size));
+}
+
+engine::CompletionToken engine::immediateUpdate(ignis::BufferId buffer,
+												const void* data,
+												VkDeviceSize offset,
+												VkDeviceSize size) {
+	return upload(buffer, data, offset, size);
 }
 
 void engine::presentCurrent(const ignis::Swapchain& swapchain,
@@ -112,12 +471,98 @@ ignis::Command* engine::newGraphicsCommand() {
 	return new Command({.device = *g_device, .queue = g_graphicsQueue});
 }
 
+ignis::Command* engine::newUploadCommand() {
+	CHECK_INIT;
+
+	return new Command({.device = *g_device, .queue = g_uploadQueue});
+}
+
 void engine::queueForDeletion(std::function<void()> func) {
 	CHECK_INIT;
 
 	g_deletionQueue.push_back(func);
 }
 
+engine::CompletionToken engine::nextToken() {
+	return ++g_lastToken;
+}
+
+void engine::signalToken(CompletionToken token) {
+	// the queue completes submissions in order
+	g_completedToken = std::max(g_completedToken, token);
+}
+
+engine::CompletionToken engine::getCompletedToken() {
+	return g_completedToken;
+}
+
+void engine::beginFrameRecording() {
+	g_recordingFrames++;
+}
+
+void engine::endFrameRecording(CompletionToken token) {
+	if (g_recordingFrames > 0) {
+		g_recordingFrames--;
+	}
+
+	if (g_recordingFrames > 0) {
+		return;
+	}
+
+	for (auto& func : g_pendingRetire) {
+		g_retireQueue.push_back({token, std::move(func)});
+	}
+
+	g_pendingRetire.clear();
+}
+
+void engine::queueForRetirement(std::function<void()> func) {
+	CHECK_INIT;
+
+	if (g_recordingFrames > 0) {
+		g_pendingRetire.push_back(std::move(func));
+		return;
+	}
+
+	// either the last submission or the upload batch being recorded
+	g_retireQueue.push_back({g_lastToken, std::move(func)});
+}
+
+void engine::retireBuffer(ignis::BufferId buffer, MemoryCategory category) {
+	if (buffer == IGNIS_INVALID_BUFFER_ID) {
+		return;
+	}
+
+	queueForRetirement([=] {
+		trackMemory(category, -int64_t(g_device->getBuffer(buffer).getSize()));
+		g_device->destroyBuffer(buffer);
+	});
+}
+
+void engine::retireResources() {
+	while (!g_retireQueue.empty() &&
+		   g_retireQueue.front().token <= g_completedToken) {
+		// pop first, destroy callbacks may retire more resources
+		auto destroy = std::move(g_retireQueue.front().destroy);
+		g_retireQueue.pop_front();
+		destroy();
+	}
+}
+
+VkPipelineCache engine::getPipelineCache() {
+	CHECK_INIT;
+
+	return g_pipelineCache;
+}
+
+bool engine::isPipelineCacheUsedByMaterials() {
+#ifdef ETNA_IGNIS_PIPELINE_CACHE
+	return true;
+#else
+	return false;
+#endif
+}
+
 uint32_t engine::clampSampleCount(uint32_t sampleCount) {
 	CHECK_INIT;
 
@@ -132,48 +577,132 @@ uint32_t engine::clampSampleCount(uint32_t sampleCount) {
 	return sampleCount > maxToUse ? maxToUse : sampleCount;
 }
 
-ignis::Shader* engine::newShader(const std::string& path) {
+uint32_t engine::findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags flags) {
 	CHECK_INIT;
 
-	const std::string::size_type extPos = path.find_last_of('.');
-	const std::string ext = path.substr(extPos + 1);
+	VkPhysicalDeviceMemoryProperties memory{};
+	vkGetPhysicalDeviceMemoryProperties(g_device->getPhysicalDevice(), &memory);
+
+	for (uint32_t i{0}; i < memory.memoryTypeCount; i++) {
+		if ((typeBits & (1u << i)) &&
+			(memory.memoryTypes[i].propertyFlags & flags) == flags) {
+			return i;
+		}
+	}
+
+	return UINT32_MAX;
+}
+
+engine::ShaderHandle engine::getShader(const std::string& name) {
+	CHECK_INIT;
+
+	const std::string::size_type extPos = name.find_last_of('.');
+	const std::string ext = name.substr(extPos + 1);
 
 	const VkShaderStageFlagBits stage =
 		ext == "vert" ? VK_SHADER_STAGE_VERTEX_BIT : VK_SHADER_STAGE_FRAGMENT_BIT;
 
-	const std::string shaderPath = g_shadersFolder + "/" + path + ".spv";
+	std::span<const unsigned char> code = getArchivedShader(name);
 
-	ignis::Shader* shader =
-		new Shader(g_device->createShader(shaderPath, stage, sizeof(PushConstants)));
+	if (!code.empty()) {
+		return getShader(code.data(), code.size(), stage);
+	}
 
-	return shader;
+	const std::string shaderPath = g_shadersFolder + "/" + name + ".spv";
+
+	std::ifstream file(shaderPath, std::ios::binary);
+
+	if (!file) {
+		throw std::runtime_error("failed to open shader " + shaderPath);
+	}
+
+	const std::vector<unsigned char> data(std::istreambuf_iterator<char>(file),
+										  {});
+
+	return getShader(data.data(), data.size(), stage);
 }
 
-ignis::Shader* engine::newShader(const unsigned char* code,
-								 size_t size,
-								 VkShaderStageFlagBits stage) {
+engine::ShaderHandle engine::getShader(const unsigned char* code,
+									   size_t size,
+									   VkShaderStageFlagBits stage) {
 	CHECK_INIT;
 
-	return new Shader(
-		g_device->createShader(code, size, stage, sizeof(PushConstants)));
+	// FNV-1a over the SPIR-V words, mixed with the stage
+	uint64_t hash{0xcbf29ce484222325};
+
+	for (size_t i{0}; i < size; i++) {
+		hash = (hash ^ code[i]) * 0x100000001b3;
+	}
+
+	hash ^= static_cast<uint64_t>(stage) << 56;
+
+	const auto [first, last] = g_shaderCache.equal_range(hash);
+
+	for (auto it = first; it != last; it++) {
+		const CachedShader& cached = it->second;
+
+		if (cached.stage != stage || cached.code.size() != size ||
+			std::memcmp(cached.code.data(), code, size) != 0)
+			continue;
+
+		if (ShaderHandle shader = cached.shader.lock()) {
+			return shader;
+		}
+	}
+
+	// modules are created rarely, drop the ones nobody holds anymore
+	std::erase_if(g_shaderCache, [](const auto& entry) {
+		return entry.second.shader.expired();
+	});
+
+	ShaderHandle shader(new Shader(
+		g_device->createShader(code, size, stage, sizeof(PushConstants))));
+
+	g_shaderCache.insert({hash,
+						  {
+							  .stage = stage,
+							  .code = {code, code + size},
+							  .shader = shader,
+						  }});
+
+	return shader;
 }
 
-float engine::getDeltaTime() {
-	CHECK_INIT;
+std::span<const unsigned char> engine::getArchivedShader(const std::string& name) {
+	for (const ShaderArchive& archive : g_shaderArchives) {
+		auto it = archive.entries.find(name);
 
-	return g_deltaTime;
+		if (it != archive.entries.end()) {
+			return it->second;
+		}
+	}
+
+	return {};
 }
 
-float engine::updateTime() {
+std::future<void> engine::runAsync(std::function<void()> task) {
 	CHECK_INIT;
 
-	static float lastTime = 0;
-	static float currentTime = 0;
+	return g_threadPool->submit(std::move(task));
+}
 
-	lastTime = currentTime;
-	currentTime = (float)glfwGetTime();
+engine::TransferCounters engine::getTransferCounters() {
+	return g_transferCounters;
+}
+
+void engine::countBufferUpdate(VkDeviceSize size) {
+	g_transferCounters.bufferUpdates++;
+	g_transferCounters.bufferUpdateBytes += size;
+}
+
+void engine::updateBuffer(BufferId buffer,
+						  const void* data,
+						  VkDeviceSize offset,
+						  VkDeviceSize size) {
+	CHECK_INIT;
 
-	g_deltaTime = currentTime - lastTime;
+	ETNA_STAT(countBufferUpdate(
+		size ? size : g_device->getBuffer(buffer).getSize() - offset));
 
-	return g_deltaTime;
+	g_device->updateBuffer(buffer, data, offset, size);
 }
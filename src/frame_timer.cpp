@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include "ignis/fence.hpp"
+#include "etna/engine.hpp"
+
+using namespace etna;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// 0.1 ms buckets up to 200 ms, the last one also takes everything above
+constexpr double BUCKET_MS{0.1};
+constexpr uint32_t BUCKET_COUNT{2000};
+
+// frames shorter than this never count as stutters, however small the median
+constexpr double MIN_STUTTER_MS{1.0};
+
+// fixed-size storage only, so recording a frame never allocates
+struct FrameTimer {
+	Clock::time_point lastFrame;
+	bool started{false};
+
+	std::array<uint32_t, BUCKET_COUNT> buckets{};
+
+	// the rolling window, needed to evict frames from the histogram
+	std::array<double, engine::FRAME_TIME_WINDOW> frameMs{};
+	std::array<double, engine::FRAME_TIME_WINDOW> waitMs{};
+	uint64_t recorded{0};
+
+	double frameSum{0};
+	double waitSum{0};
+	uint64_t stutters{0};
+
+	double pendingWait{0};
+};
+
+FrameTimer g_timer;
+float g_deltaTime{0};
+
+}
+
+static uint32_t bucketOf(double ms) {
+	return std::min(BUCKET_COUNT - 1, static_cast<uint32_t>(ms / BUCKET_MS));
+}
+
+static uint32_t windowSize() {
+	return static_cast<uint32_t>(
+		std::min<uint64_t>(g_timer.recorded, engine::FRAME_TIME_WINDOW));
+}
+
+static double maxFrameMs() {
+	const uint32_t count = windowSize();
+
+	return count ? *std::max_element(g_timer.frameMs.begin(),
+									 g_timer.frameMs.begin() + count)
+				 : 0;
+}
+
+// upper edge of the bucket holding the given percentile, capped to the max
+static double percentileMs(double percentile) {
+	const uint32_t count = windowSize();
+
+	if (count == 0) {
+		return 0;
+	}
+
+	const uint32_t rank =
+		std::max(1u, static_cast<uint32_t>(std::ceil(percentile * count)));
+
+	uint32_t seen{0};
+
+	for (uint32_t i{0}; i < BUCKET_COUNT; i++) {
+		seen += g_timer.buckets[i];
+
+		if (seen >= rank) {
+			return std::min((i + 1) * BUCKET_MS, maxFrameMs());
+		}
+	}
+
+	return maxFrameMs();
+}
+
+static void recordFrame(double frameMs) {
+	const uint32_t slot = g_timer.recorded % engine::FRAME_TIME_WINDOW;
+	const double median = percentileMs(0.5);
+
+	if (g_timer.recorded >= engine::FRAME_TIME_WINDOW) {
+		g_timer.buckets[bucketOf(g_timer.frameMs[slot])]--;
+		g_timer.frameSum -= g_timer.frameMs[slot];
+		g_timer.waitSum -= g_timer.waitMs[slot];
+	}
+
+	if (windowSize() >= 8 && frameMs > std::max(2 * median, MIN_STUTTER_MS)) {
+		g_timer.stutters++;
+	}
+
+	const double waitMs = std::min(g_timer.pendingWait * 1000.0, frameMs);
+
+	g_timer.frameMs[slot] = frameMs;
+	g_timer.waitMs[slot] = waitMs;
+	g_timer.buckets[bucketOf(frameMs)]++;
+	g_timer.frameSum += frameMs;
+	g_timer.waitSum += waitMs;
+	g_timer.recorded++;
+
+	g_timer.pendingWait = 0;
+}
+
+float engine::getDeltaTime() {
+	return g_deltaTime;
+}
+
+float engine::updateTime() {
+	// steady_clock instead of glfwGetTime so headless runs keep time too, and
+	// in double so long uptimes don't lose precision
+	const Clock::time_point now = Clock::now();
+
+	if (!g_timer.started) {
+		g_timer.started = true;
+		g_timer.lastFrame = now;
+		g_deltaTime = 0;
+
+		return g_deltaTime;
+	}
+
+	const double delta =
+		std::chrono::duration<double>(now - g_timer.lastFrame).count();
+
+	g_timer.lastFrame = now;
+
+	recordFrame(delta * 1000.0);
+
+	g_deltaTime = static_cast<float>(delta);
+
+	return g_deltaTime;
+}
+
+void engine::waitFence(ignis::Fence& fence) {
+	const Clock::time_point start = Clock::now();
+
+	fence.wait();
+
+	g_timer.pendingWait +=
+		std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+engine::FrameTimeStats engine::getFrameTimeStats() {
+	const uint32_t count = windowSize();
+
+	if (count == 0) {
+		return {};
+	}
+
+	const double meanMs = g_timer.frameSum / count;
+	const double waitMs = g_timer.waitSum / count;
+
+	return {
+		.frames = count,
+		.meanMs = meanMs,
+		.p50Ms = percentileMs(0.50),
+		.p95Ms = percentileMs(0.95),
+		.p99Ms = percentileMs(0.99),
+		.maxMs = maxFrameMs(),
+		.stutters = g_timer.stutters,
+		.waitMs = waitMs,
+		.workMs = meanMs - waitMs,
+	};
+}
+
+void engine::resetFrameTimeStats() {
+	const Clock::time_point lastFrame = g_timer.lastFrame;
+	const bool started = g_timer.started;
+
+	g_timer = {};
+	g_timer.lastFrame = lastFrame;
+	g_timer.started = started;
+}
+
+void engine::writeFrameTimeReport(const std::string& path) {
+	std::ofstream file(path);
+
+	if (!file) {
+		throw std::runtime_error("failed to open " + path);
+	}
+
+	const FrameTimeStats stats = getFrameTimeStats();
+
+	file << "{\n"
+		 << "  \"frames\": " << stats.frames << ",\n"
+		 << "  \"meanMs\": " << stats.meanMs << ",\n"
+		 << "  \"p50Ms\": " << stats.p50Ms << ",\n"
+		 << "  \"p95Ms\": " << stats.p95Ms << ",\n"
+		 << "  \"p99Ms\": " << stats.p99Ms << ",\n"
+		 << "  \"maxMs\": " << stats.maxMs << ",\n"
+		 << "  \"stutters\": " << stats.stutters << ",\n"
+		 << "  \"waitMs\": " << stats.waitMs << ",\n"
+		 << "  \"workMs\": " << stats.workMs << ",\n"
+		 << "  \"histogram\": [";
+
+	// sparse: [bucket start in ms, count] for the non-empty buckets
+	bool first{true};
+
+	for (uint32_t i{0}; i < BUCKET_COUNT; i++) {
+		if (g_timer.buckets[i] == 0) {
+			continue;
+		}
+
+		file << (first ? "" : ", ") << "[" << i * BUCKET_MS << ", "
+			 << g_timer.buckets[i] << "]";
+
+		first = false;
+	}
+
+	file << "]\n}\n";
+}
@@ -0,0 +1,875 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include "gpu_culler.hpp"
+#include "etna/engine.hpp"
+#include "etna/default_materials.hpp"
+#include "etna/trace.hpp"
+
+using namespace etna;
+using namespace ignis;
+
+namespace {
+
+// the largest minStorageBufferOffsetAlignment the spec allows
+constexpr VkDeviceSize STORAGE_ALIGNMENT{256};
+
+constexpr uint32_t CULL_GROUP_SIZE{64};
+constexpr uint32_t HIZ_GROUP_SIZE{8};
+
+// a descriptor pool fits this many cullIndirect calls and one pyramid build;
+// a frame needing more chains another pool
+constexpr uint32_t CULLS_PER_POOL{32};
+constexpr uint32_t MAX_HIZ_LEVELS{16};
+
+// pyramids of targets that stopped being culled are freed after this long
+constexpr uint64_t PYRAMID_IDLE_FRAMES{120};
+
+constexpr VkDeviceSize INITIAL_BUFFER_SIZE{64 * 1024};
+
+// mirror the buffers of cull.comp
+struct CullParams {
+	Vec4 planes[6];
+	Mat4 hizViewProj;
+	float viewport[4];
+	uint32_t drawCount;
+	uint32_t hizLevels;
+};
+
+struct CullDraw {
+	float sphere[4];
+	VkDrawIndexedIndirectCommand command;
+	uint32_t range;
+	uint32_t first;
+	uint32_t padding;
+};
+
+static_assert(sizeof(CullDraw) == 48);
+
+struct HiZConstants {
+	int32_t srcSize[2];
+	int32_t dstSize[2];
+};
+
+}
+
+static VkDeviceSize alignUp(VkDeviceSize value) {
+	return (value + STORAGE_ALIGNMENT - 1) / STORAGE_ALIGNMENT * STORAGE_ALIGNMENT;
+}
+
+static bool sameViewport(const Viewport& a, const Viewport& b) {
+	return a.x == b.x && a.y == b.y && a.width == b.width && a.height == b.height;
+}
+
+static void computeBarrier(VkCommandBuffer cmd,
+						   VkPipelineStageFlags srcStage,
+						   VkAccessFlags srcAccess,
+						   VkPipelineStageFlags dstStage,
+						   VkAccessFlags dstAccess) {
+	const VkMemoryBarrier barrier{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = srcAccess,
+		.dstAccessMask = dstAccess,
+	};
+
+	vkCmdPipelineBarrier(cmd, srcStage, dstStage, 0, 1, &barrier, 0, nullptr, 0,
+						 nullptr);
+}
+
+static VkPipeline createComputePipeline(const RawShader& shader,
+										VkPipelineLayout layout) {
+	VkDevice device = _device.getDevice();
+
+	const VkShaderModuleCreateInfo moduleInfo{
+		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+		.codeSize = shader.size,
+		.pCode = reinterpret_cast<const uint32_t*>(shader.code),
+	};
+
+	VkShaderModule module{VK_NULL_HANDLE};
+
+	if (vkCreateShaderModule(device, &moduleInfo, nullptr, &module) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create compute shader module");
+	}
+
+	const VkComputePipelineCreateInfo pipelineInfo{
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.stage =
+			{
+				.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+				.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+				.module = module,
+				.pName = "main",
+			},
+		.layout = layout,
+	};
+
+	VkPipeline pipeline{VK_NULL_HANDLE};
+
+	const VkResult result = vkCreateComputePipelines(
+		device, engine::getPipelineCache(), 1, &pipelineInfo, nullptr, &pipeline);
+
+	vkDestroyShaderModule(device, module, nullptr);
+
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("failed to create compute pipeline");
+	}
+
+	return pipeline;
+}
+
+static VkDescriptorSetLayout createSetLayout(
+	std::span<const VkDescriptorSetLayoutBinding> bindings) {
+	const VkDescriptorSetLayoutCreateInfo layoutInfo{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.bindingCount = static_cast<uint32_t>(bindings.size()),
+		.pBindings = bindings.data(),
+	};
+
+	VkDescriptorSetLayout layout{VK_NULL_HANDLE};
+
+	if (vkCreateDescriptorSetLayout(_device.getDevice(), &layoutInfo, nullptr,
+									&layout) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create descriptor set layout");
+	}
+
+	return layout;
+}
+
+static VkPipelineLayout createPipelineLayout(VkDescriptorSetLayout setLayout,
+											 uint32_t pushConstantSize) {
+	const VkPushConstantRange range{
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = pushConstantSize,
+	};
+
+	const VkPipelineLayoutCreateInfo layoutInfo{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.setLayoutCount = 1,
+		.pSetLayouts = &setLayout,
+		.pushConstantRangeCount = pushConstantSize > 0 ? 1u : 0u,
+		.pPushConstantRanges = &range,
+	};
+
+	VkPipelineLayout layout{VK_NULL_HANDLE};
+
+	if (vkCreatePipelineLayout(_device.getDevice(), &layoutInfo, nullptr,
+							   &layout) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create pipeline layout");
+	}
+
+	return layout;
+}
+
+GpuCuller::GpuCuller(uint32_t framesInFlight) {
+	VkDevice device = _device.getDevice();
+
+	const VkSamplerCreateInfo samplerInfo{
+		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+		.magFilter = VK_FILTER_NEAREST,
+		.minFilter = VK_FILTER_NEAREST,
+		.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.maxLod = VK_LOD_CLAMP_NONE,
+	};
+
+	if (vkCreateSampler(device, &samplerInfo, nullptr, &m_sampler) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create Hi-Z sampler");
+	}
+
+	const VkDescriptorSetLayoutBinding cullBindings[]{
+		{0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+		{1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+		{2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+		{3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+		{4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1,
+		 VK_SHADER_STAGE_COMPUTE_BIT},
+	};
+
+	const VkDescriptorSetLayoutBinding hizBindings[]{
+		{0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1,
+		 VK_SHADER_STAGE_COMPUTE_BIT},
+		{1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+	};
+
+	m_cullSetLayout = createSetLayout(cullBindings);
+	m_cullLayout = createPipelineLayout(m_cullSetLayout, 0);
+	m_cullPipeline =
+		createComputePipeline(engine::getCullCompShader(), m_cullLayout);
+
+	m_hizSetLayout = createSetLayout(hizBindings);
+	m_hizLayout = createPipelineLayout(m_hizSetLayout, sizeof(HiZConstants));
+	m_hizPipeline = createComputePipeline(engine::getHiZCompShader(), m_hizLayout);
+
+	m_frames.resize(framesInFlight);
+
+	for (FrameData& frame : m_frames) {
+		frame.pools.push_back(createDescriptorPool());
+	}
+}
+
+GpuCuller::~GpuCuller() {
+	VkDevice device = _device.getDevice();
+
+	// the renderer waited on every frame slot before destroying us
+	for (FrameData& frame : m_frames) {
+		for (VkDescriptorPool pool : frame.pools) {
+			vkDestroyDescriptorPool(device, pool, nullptr);
+		}
+
+		destroyBuffer(frame.input);
+		destroyBuffer(frame.commands);
+		destroyBuffer(frame.counts);
+
+		for (const RawBuffer& buffer : frame.retired) {
+			destroyBuffer(buffer);
+		}
+	}
+
+	for (const auto& [id, pyramid] : m_pyramids) {
+		destroyPyramid(pyramid);
+	}
+
+	vkDestroyPipeline(device, m_cullPipeline, nullptr);
+	vkDestroyPipelineLayout(device, m_cullLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, m_cullSetLayout, nullptr);
+
+	vkDestroyPipeline(device, m_hizPipeline, nullptr);
+	vkDestroyPipelineLayout(device, m_hizLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, m_hizSetLayout, nullptr);
+
+	vkDestroySampler(device, m_sampler, nullptr);
+}
+
+VkDescriptorPool GpuCuller::createDescriptorPool() {
+	const VkDescriptorPoolSize poolSizes[]{
+		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, CULLS_PER_POOL * 4},
+		{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, CULLS_PER_POOL + MAX_HIZ_LEVELS},
+		{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_HIZ_LEVELS},
+	};
+
+	const VkDescriptorPoolCreateInfo poolInfo{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.maxSets = CULLS_PER_POOL + MAX_HIZ_LEVELS,
+		.poolSizeCount = 3,
+		.pPoolSizes = poolSizes,
+	};
+
+	VkDescriptorPool pool{VK_NULL_HANDLE};
+
+	if (vkCreateDescriptorPool(_device.getDevice(), &poolInfo, nullptr, &pool) !=
+		VK_SUCCESS) {
+		throw std::runtime_error("failed to create culling descriptor pool");
+	}
+
+	return pool;
+}
+
+GpuCuller::RawBuffer GpuCuller::createBuffer(VkDeviceSize size,
+											 VkBufferUsageFlags usage,
+											 bool hostVisible) {
+	VkDevice device = _device.getDevice();
+
+	RawBuffer buffer{.size = size};
+
+	const VkBufferCreateInfo bufferInfo{
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = size,
+		.usage = usage,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	};
+
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer.buffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create culling buffer");
+	}
+
+	VkMemoryRequirements requirements{};
+	vkGetBufferMemoryRequirements(device, buffer.buffer, &requirements);
+
+	const uint32_t memoryType = engine::findMemoryType(
+		requirements.memoryTypeBits,
+		hostVisible ? VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+						  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+					: VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	const VkMemoryAllocateInfo allocInfo{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.allocationSize = requirements.size,
+		.memoryTypeIndex = memoryType,
+	};
+
+	if (memoryType == UINT32_MAX ||
+		vkAllocateMemory(device, &allocInfo, nullptr, &buffer.memory) !=
+			VK_SUCCESS) {
+		vkDestroyBuffer(device, buffer.buffer, nullptr);
+		throw std::runtime_error("failed to allocate culling buffer memory");
+	}
+
+	if (vkBindBufferMemory(device, buffer.buffer, buffer.memory, 0) != VK_SUCCESS ||
+		(hostVisible && vkMapMemory(device, buffer.memory, 0, VK_WHOLE_SIZE, 0,
+									&buffer.mapped) != VK_SUCCESS)) {
+		vkDestroyBuffer(device, buffer.buffer, nullptr);
+		vkFreeMemory(device, buffer.memory, nullptr);
+		throw std::runtime_error("failed to bind culling buffer memory");
+	}
+
+	engine::trackMemory(engine::MemoryCategory::INSTANCE_BUFFER, size);
+
+	return buffer;
+}
+
+void GpuCuller::destroyBuffer(const RawBuffer& buffer) {
+	if (buffer.buffer == VK_NULL_HANDLE)
+		return;
+
+	VkDevice device = _device.getDevice();
+
+	vkDestroyBuffer(device, buffer.buffer, nullptr);
+	vkFreeMemory(device, buffer.memory, nullptr);
+
+	engine::trackMemory(engine::MemoryCategory::INSTANCE_BUFFER,
+						-int64_t(buffer.size));
+}
+
+VkDeviceSize GpuCuller::suballocate(FrameData& frame,
+									RawBuffer& buffer,
+									VkDeviceSize size,
+									VkBufferUsageFlags usage,
+									bool hostVisible) {
+	const VkDeviceSize offset = alignUp(buffer.used);
+
+	if (buffer.buffer != VK_NULL_HANDLE && offset + size <= buffer.size) {
+		buffer.used = offset + size;
+		return offset;
+	}
+
+	// earlier dispatches of this frame may still reference the old one
+	if (buffer.buffer != VK_NULL_HANDLE) {
+		frame.retired.push_back(buffer);
+	}
+
+	buffer = createBuffer(
+		std::max({INITIAL_BUFFER_SIZE, alignUp(size), buffer.size * 2}), usage,
+		hostVisible);
+
+	buffer.used = size;
+
+	return 0;
+}
+
+void GpuCuller::beginFrame(uint32_t frameIndex) {
+	m_currentFrame = frameIndex;
+	m_frameCount++;
+
+	FrameData& frame = m_frames[frameIndex];
+
+	for (const RawBuffer& buffer : frame.retired) {
+		destroyBuffer(buffer);
+	}
+
+	frame.retired.clear();
+
+	frame.input.used = 0;
+	frame.commands.used = 0;
+	frame.counts.used = 0;
+
+	for (auto it = m_pyramids.begin(); it != m_pyramids.end();) {
+		if (m_frameCount - it->second.lastUsed > PYRAMID_IDLE_FRAMES) {
+			destroyPyramid(it->second);
+			it = m_pyramids.erase(it);
+			continue;
+		}
+
+		// views of frames that ended without building the pyramid are dropped
+		it->second.frameViews.clear();
+		++it;
+	}
+
+	for (VkDescriptorPool pool : frame.pools) {
+		vkResetDescriptorPool(_device.getDevice(), pool, 0);
+	}
+
+	frame.currentPool = 0;
+}
+
+VkDescriptorSet GpuCuller::allocateSet(VkDescriptorSetLayout layout) {
+	FrameData& frame = m_frames[m_currentFrame];
+
+	while (true) {
+		const bool fresh = frame.currentPool == frame.pools.size();
+
+		if (fresh) {
+			frame.pools.push_back(createDescriptorPool());
+		}
+
+		const VkDescriptorSetAllocateInfo allocInfo{
+			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+			.descriptorPool = frame.pools[frame.currentPool],
+			.descriptorSetCount = 1,
+			.pSetLayouts = &layout,
+		};
+
+		VkDescriptorSet set{VK_NULL_HANDLE};
+
+		const VkResult result =
+			vkAllocateDescriptorSets(_device.getDevice(), &allocInfo, &set);
+
+		if (result == VK_SUCCESS) {
+			return set;
+		}
+
+		// the pool is full: move on to the next one, the pools stay chained
+		// to the slot and are reset with it
+		if (fresh || (result != VK_ERROR_OUT_OF_POOL_MEMORY &&
+					  result != VK_ERROR_FRAGMENTED_POOL)) {
+			throw std::runtime_error("failed to allocate culling descriptor set");
+		}
+
+		frame.currentPool++;
+	}
+}
+
+GpuCuller::Pyramid& GpuCuller::ensurePyramid(Command& cmd,
+											 const RenderTarget& target) {
+	const VkExtent2D extent = target.getExtent();
+
+	Pyramid& pyramid = m_pyramids[target.getId()];
+
+	pyramid.lastUsed = m_frameCount;
+
+	if (pyramid.extent.width == extent.width &&
+		pyramid.extent.height == extent.height) {
+		return pyramid;
+	}
+
+	destroyPyramid(pyramid);
+
+	pyramid = {.lastUsed = m_frameCount};
+
+	VkDevice device = _device.getDevice();
+
+	const uint32_t levels = std::min<uint32_t>(
+		MAX_HIZ_LEVELS, std::bit_width(std::max(extent.width, extent.height)));
+
+	const VkImageCreateInfo imageInfo{
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = VK_FORMAT_R32_SFLOAT,
+		.extent = {extent.width, extent.height, 1},
+		.mipLevels = levels,
+		.arrayLayers = 1,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_OPTIMAL,
+		.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT |
+				 VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	};
+
+	if (vkCreateImage(device, &imageInfo, nullptr, &pyramid.image) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create Hi-Z pyramid");
+	}
+
+	VkMemoryRequirements requirements{};
+	vkGetImageMemoryRequirements(device, pyramid.image, &requirements);
+
+	const VkMemoryAllocateInfo allocInfo{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.allocationSize = requirements.size,
+		.memoryTypeIndex = engine::findMemoryType(
+			requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+	};
+
+	if (allocInfo.memoryTypeIndex == UINT32_MAX ||
+		vkAllocateMemory(device, &allocInfo, nullptr, &pyramid.memory) !=
+			VK_SUCCESS) {
+		vkDestroyImage(device, pyramid.image, nullptr);
+		pyramid = {};
+		throw std::runtime_error("failed to allocate Hi-Z pyramid memory");
+	}
+
+	if (vkBindImageMemory(device, pyramid.image, pyramid.memory, 0) !=
+		VK_SUCCESS) {
+		vkDestroyImage(device, pyramid.image, nullptr);
+		vkFreeMemory(device, pyramid.memory, nullptr);
+		pyramid = {};
+		throw std::runtime_error("failed to bind Hi-Z pyramid memory");
+	}
+
+	pyramid.size = requirements.size;
+
+	engine::trackMemory(engine::MemoryCategory::RENDER_TARGET, pyramid.size);
+
+	pyramid.depth = createBuffer(
+		VkDeviceSize(extent.width) * extent.height * sizeof(float),
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, false);
+
+	VkImageViewCreateInfo viewInfo{
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.image = pyramid.image,
+		.viewType = VK_IMAGE_VIEW_TYPE_2D,
+		.format = VK_FORMAT_R32_SFLOAT,
+		.subresourceRange =
+			{
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = 0,
+				.levelCount = levels,
+				.baseArrayLayer = 0,
+				.layerCount = 1,
+			},
+	};
+
+	if (vkCreateImageView(device, &viewInfo, nullptr, &pyramid.view) !=
+		VK_SUCCESS) {
+		throw std::runtime_error("failed to create Hi-Z pyramid view");
+	}
+
+	pyramid.levels.resize(levels);
+
+	for (uint32_t level{0}; level < levels; level++) {
+		viewInfo.subresourceRange.baseMipLevel = level;
+		viewInfo.subresourceRange.levelCount = 1;
+
+		if (vkCreateImageView(device, &viewInfo, nullptr,
+							  &pyramid.levels[level]) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create Hi-Z level view");
+		}
+	}
+
+	pyramid.extent = extent;
+
+	// stays in general layout: level 0 is a copy destination, the others are
+	// written and read by compute only
+	const VkImageMemoryBarrier barrier{
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.srcAccessMask = 0,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT |
+						 VK_ACCESS_TRANSFER_WRITE_BIT,
+		.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.newLayout = VK_IMAGE_LAYOUT_GENERAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = pyramid.image,
+		.subresourceRange =
+			{
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = 0,
+				.levelCount = levels,
+				.baseArrayLayer = 0,
+				.layerCount = 1,
+			},
+	};
+
+	vkCmdPipelineBarrier(cmd.getHandle(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+						 VK_PIPELINE_STAGE_TRANSFER_BIT |
+							 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+						 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	return pyramid;
+}
+
+void GpuCuller::destroyPyramid(const Pyramid& pyramid) {
+	if (pyramid.image == VK_NULL_HANDLE)
+		return;
+
+	engine::queueForRetirement([pyramid] {
+		VkDevice device = _device.getDevice();
+
+		for (VkImageView level : pyramid.levels) {
+			vkDestroyImageView(device, level, nullptr);
+		}
+
+		vkDestroyImageView(device, pyramid.view, nullptr);
+		vkDestroyImage(device, pyramid.image, nullptr);
+		vkFreeMemory(device, pyramid.memory, nullptr);
+
+		destroyBuffer(pyramid.depth);
+
+		engine::trackMemory(engine::MemoryCategory::RENDER_TARGET,
+							-int64_t(pyramid.size));
+	});
+}
+
+void GpuCuller::cull(Command& cmd,
+					 const RenderTarget& target,
+					 std::span<const VkDrawIndexedIndirectCommand> commands,
+					 std::span<const BoundingSphere> bounds,
+					 std::span<const CullRange> ranges,
+					 const GpuCullView& view) {
+	ETNA_TRACE_SCOPE("GpuCuller::cull");
+
+	assert(commands.size() == bounds.size() && !ranges.empty());
+
+	FrameData& frame = m_frames[m_currentFrame];
+
+	Pyramid& pyramid = ensurePyramid(cmd, target);
+
+	// the pyramid is only usable for viewports it has a view-projection for
+	const HiZView* hizView{nullptr};
+
+	for (const HiZView& candidate : pyramid.views) {
+		if (sameViewport(candidate.viewport, view.viewport)) {
+			hizView = &candidate;
+		}
+	}
+
+	pyramid.frameViews.push_back({view.viewport, view.viewProj});
+
+	const Frustum frustum = Frustum::fromMatrix(view.viewProj);
+
+	CullParams params{
+		.hizViewProj = hizView ? hizView->viewProj : Mat4::identity(),
+		.viewport = {view.viewport.x, view.viewport.y, view.viewport.width,
+					 view.viewport.height},
+		.drawCount = static_cast<uint32_t>(commands.size()),
+		.hizLevels = hizView ? static_cast<uint32_t>(pyramid.levels.size()) : 0,
+	};
+
+	std::copy(std::begin(frustum.planes), std::end(frustum.planes), params.planes);
+
+	const VkDeviceSize drawsSize = commands.size() * sizeof(CullDraw);
+
+	const VkDeviceSize inputOffset =
+		suballocate(frame, frame.input, alignUp(sizeof(CullParams)) + drawsSize,
+					VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, true);
+
+	const VkDeviceSize drawsOffset = inputOffset + alignUp(sizeof(CullParams));
+
+	char* input = static_cast<char*>(frame.input.mapped);
+
+	std::memcpy(input + inputOffset, &params, sizeof(params));
+
+	CullDraw* draws = reinterpret_cast<CullDraw*>(input + drawsOffset);
+
+	for (uint32_t r{0}; r < ranges.size(); r++) {
+		const CullRange& range = ranges[r];
+
+		for (uint32_t i{range.first}; i < range.first + range.count; i++) {
+			const BoundingSphere& sphere = bounds[i];
+
+			draws[i] = {
+				.sphere = {sphere.center[0], sphere.center[1], sphere.center[2],
+						   sphere.radius},
+				.command = commands[i],
+				.range = r,
+				.first = range.first,
+			};
+		}
+	}
+
+	const VkDeviceSize commandsSize =
+		commands.size() * sizeof(VkDrawIndexedIndirectCommand);
+
+	const VkDeviceSize commandsOffset = suballocate(
+		frame, frame.commands, commandsSize,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+		false);
+
+	const VkDeviceSize countsSize = ranges.size() * sizeof(uint32_t);
+
+	const VkDeviceSize countsOffset =
+		suballocate(frame, frame.counts, countsSize,
+					VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+						VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+						VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+					false);
+
+	const VkDescriptorSet set = allocateSet(m_cullSetLayout);
+
+	const VkDescriptorBufferInfo buffers[]{
+		{frame.input.buffer, inputOffset, sizeof(CullParams)},
+		{frame.input.buffer, drawsOffset, drawsSize},
+		{frame.commands.buffer, commandsOffset, commandsSize},
+		{frame.counts.buffer, countsOffset, countsSize},
+	};
+
+	const VkDescriptorImageInfo hiz{
+		.sampler = m_sampler,
+		.imageView = pyramid.view,
+		.imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+	};
+
+	VkWriteDescriptorSet writes[5]{};
+
+	for (uint32_t i{0}; i < 5; i++) {
+		writes[i] = {
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = set,
+			.dstBinding = i,
+			.descriptorCount = 1,
+			.descriptorType = i < 4 ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+									: VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.pImageInfo = i < 4 ? nullptr : &hiz,
+			.pBufferInfo = i < 4 ? &buffers[i] : nullptr,
+		};
+	}
+
+	vkUpdateDescriptorSets(_device.getDevice(), 5, writes, 0, nullptr);
+
+	VkCommandBuffer handle = cmd.getHandle();
+
+	vkCmdFillBuffer(handle, frame.counts.buffer, countsOffset, countsSize, 0);
+
+	computeBarrier(handle, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				   VK_ACCESS_TRANSFER_WRITE_BIT,
+				   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				   VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	vkCmdBindPipeline(handle, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipeline);
+	vkCmdBindDescriptorSets(handle, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullLayout,
+							0, 1, &set, 0, nullptr);
+
+	vkCmdDispatch(handle,
+				  (params.drawCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+	computeBarrier(handle, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				   VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+				   VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+
+	m_output = {
+		.commands = frame.commands.buffer,
+		.commandsOffset = commandsOffset,
+		.counts = frame.counts.buffer,
+		.countsOffset = countsOffset,
+	};
+
+	m_ranges.assign(ranges.begin(), ranges.end());
+}
+
+void GpuCuller::drawCulled(Command& cmd, uint32_t rangeIndex) const {
+	assert(rangeIndex < m_ranges.size());
+
+	const CullRange& range = m_ranges[rangeIndex];
+
+	vkCmdDrawIndexedIndirectCount(
+		cmd.getHandle(), m_output.commands,
+		m_output.commandsOffset + range.first * sizeof(VkDrawIndexedIndirectCommand),
+		m_output.counts, m_output.countsOffset + rangeIndex * sizeof(uint32_t),
+		range.count, sizeof(VkDrawIndexedIndirectCommand));
+}
+
+void GpuCuller::buildHiZ(Command& cmd, const RenderTarget& target) {
+	ETNA_TRACE_SCOPE("GpuCuller::buildHiZ");
+
+	assert(!target.isMultiSampled());
+
+	Pyramid& pyramid = ensurePyramid(cmd, target);
+
+	Image& depth = *target.getDepthImage();
+
+	VkCommandBuffer handle = cmd.getHandle();
+
+	// this frame's culls read the pyramid before it is overwritten
+	computeBarrier(
+		handle, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	// level 0: depth to buffer to the R32 level, all plain copies
+	cmd.transitionImageLayout(depth, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+	const VkBufferImageCopy depthCopy{
+		.bufferOffset = 0,
+		.imageSubresource =
+			{
+				.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+				.mipLevel = 0,
+				.baseArrayLayer = 0,
+				.layerCount = 1,
+			},
+		.imageExtent = {pyramid.extent.width, pyramid.extent.height, 1},
+	};
+
+	vkCmdCopyImageToBuffer(handle, depth.getHandle(),
+						   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+						   pyramid.depth.buffer, 1, &depthCopy);
+
+	cmd.transitionToOptimalLayout(depth);
+
+	computeBarrier(handle, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				   VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				   VK_ACCESS_TRANSFER_READ_BIT);
+
+	VkBufferImageCopy levelCopy = depthCopy;
+	levelCopy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+
+	vkCmdCopyBufferToImage(handle, pyramid.depth.buffer, pyramid.image,
+						   VK_IMAGE_LAYOUT_GENERAL, 1, &levelCopy);
+
+	computeBarrier(handle, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				   VK_ACCESS_TRANSFER_WRITE_BIT,
+				   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+	vkCmdBindPipeline(handle, VK_PIPELINE_BIND_POINT_COMPUTE, m_hizPipeline);
+
+	VkExtent2D srcExtent = pyramid.extent;
+
+	for (uint32_t level{1}; level < pyramid.levels.size(); level++) {
+		const VkExtent2D dstExtent{
+			std::max(1u, srcExtent.width / 2),
+			std::max(1u, srcExtent.height / 2),
+		};
+
+		const VkDescriptorImageInfo src{
+			.sampler = m_sampler,
+			.imageView = pyramid.levels[level - 1],
+			.imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+		};
+
+		const VkDescriptorImageInfo dst{
+			.imageView = pyramid.levels[level],
+			.imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+		};
+
+		const VkDescriptorSet set = allocateSet(m_hizSetLayout);
+
+		const VkWriteDescriptorSet writes[]{
+			{
+				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+				.dstSet = set,
+				.dstBinding = 0,
+				.descriptorCount = 1,
+				.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				.pImageInfo = &src,
+			},
+			{
+				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+				.dstSet = set,
+				.dstBinding = 1,
+				.descriptorCount = 1,
+				.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+				.pImageInfo = &dst,
+			},
+		};
+
+		vkUpdateDescriptorSets(_device.getDevice(), 2, writes, 0, nullptr);
+
+		const HiZConstants constants{
+			.srcSize = {int32_t(srcExtent.width), int32_t(srcExtent.height)},
+			.dstSize = {int32_t(dstExtent.width), int32_t(dstExtent.height)},
+		};
+
+		vkCmdBindDescriptorSets(handle, VK_PIPELINE_BIND_POINT_COMPUTE, m_hizLayout,
+								0, 1, &set, 0, nullptr);
+
+		vkCmdPushConstants(handle, m_hizLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+						   sizeof(constants), &constants);
+
+		vkCmdDispatch(handle,
+					  (dstExtent.width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE,
+					  (dstExtent.height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+
+		// the next level and the next frame's culls read this one
+		computeBarrier(handle, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+					   VK_ACCESS_SHADER_WRITE_BIT,
+					   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+					   VK_ACCESS_SHADER_READ_BIT);
+
+		srcExtent = dstExtent;
+	}
+
+	pyramid.views.swap(pyramid.frameViews);
+}
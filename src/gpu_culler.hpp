@@ -0,0 +1,146 @@
+#pragma once
+
+#include <span>
+#include <unordered_map>
+#include <vector>
+#include "etna/renderer.hpp"
+
+namespace etna {
+
+// Compute culling behind Renderer::cullIndirect. Commands are tested against
+// the frustum and a Hi-Z pyramid, the farthest depth per texel at every mip,
+// built from the depth a target's frame ends with; survivors are appended to their
+// range's part of a per-frame output read by vkCmdDrawIndexedIndirectCount.
+//
+// The pyramid is tested with the view-projection it was rendered with, found
+// through the viewport, so culling stays correct while the camera moves.
+// ignis has no compute pipelines, so everything here is raw Vulkan.
+class GpuCuller {
+public:
+	GpuCuller(uint32_t framesInFlight);
+
+	~GpuCuller();
+
+	// the GPU must be done with the slot
+	void beginFrame(uint32_t frame);
+
+	// outside of rendering; replaces the ranges drawCulled draws from
+	void cull(ignis::Command&,
+			  const RenderTarget&,
+			  std::span<const VkDrawIndexedIndirectCommand>,
+			  std::span<const BoundingSphere>,
+			  std::span<const CullRange>,
+			  const GpuCullView&);
+
+	// the survivors of a range of the last cull, inside rendering
+	void drawCulled(ignis::Command&, uint32_t range) const;
+
+	uint32_t getRangeCount() const { return m_ranges.size(); }
+
+	// outside of rendering, from the target's single sampled depth
+	void buildHiZ(ignis::Command&, const RenderTarget&);
+
+private:
+	struct RawBuffer {
+		VkBuffer buffer{VK_NULL_HANDLE};
+		VkDeviceMemory memory{VK_NULL_HANDLE};
+		void* mapped{nullptr};
+		VkDeviceSize size{0};
+		VkDeviceSize used{0};
+	};
+
+	struct FrameData {
+		// chained: a pool is added when the ones before it are full
+		std::vector<VkDescriptorPool> pools;
+		uint32_t currentPool{0};
+		RawBuffer input;
+		RawBuffer commands;
+		RawBuffer counts;
+		// outgrown mid-frame, destroyed when the slot comes around again
+		std::vector<RawBuffer> retired;
+	};
+
+	struct HiZView {
+		Viewport viewport;
+		Mat4 viewProj;
+	};
+
+	// one per render target, so targets culled in the same frame don't
+	// rebuild each other's
+	struct Pyramid {
+		VkImage image{VK_NULL_HANDLE};
+		VkDeviceMemory memory{VK_NULL_HANDLE};
+		VkImageView view{VK_NULL_HANDLE};
+		std::vector<VkImageView> levels;
+		VkExtent2D extent{0, 0};
+		VkDeviceSize size{0};
+		// level 0 goes through it: depth can't be copied to a color image
+		// directly, and the target's depth is not sampled
+		RawBuffer depth;
+		// the views that rendered the depth it was built from, and the ones
+		// culled this frame, which the next build takes over
+		std::vector<HiZView> views;
+		std::vector<HiZView> frameViews;
+		uint64_t lastUsed{0};
+	};
+
+	// where the last cull wrote its survivors: range r starts at
+	// commandsOffset + first commands, its count is the r-th uint at
+	// countsOffset
+	struct Output {
+		VkBuffer commands;
+		VkDeviceSize commandsOffset;
+		VkBuffer counts;
+		VkDeviceSize countsOffset;
+	};
+
+	static RawBuffer createBuffer(VkDeviceSize size,
+								  VkBufferUsageFlags usage,
+								  bool hostVisible);
+
+	static void destroyBuffer(const RawBuffer&);
+
+	// offset of size bytes in buffer, replacing it with a larger one when it
+	// is full
+	VkDeviceSize suballocate(FrameData&,
+							 RawBuffer&,
+							 VkDeviceSize size,
+							 VkBufferUsageFlags usage,
+							 bool hostVisible);
+
+	Pyramid& ensurePyramid(ignis::Command&, const RenderTarget&);
+
+	static void destroyPyramid(const Pyramid&);
+
+	static VkDescriptorPool createDescriptorPool();
+
+	VkDescriptorSet allocateSet(VkDescriptorSetLayout);
+
+	std::vector<FrameData> m_frames;
+	uint32_t m_currentFrame{0};
+	uint64_t m_frameCount{0};
+
+	VkSampler m_sampler{VK_NULL_HANDLE};
+
+	VkDescriptorSetLayout m_cullSetLayout{VK_NULL_HANDLE};
+	VkPipelineLayout m_cullLayout{VK_NULL_HANDLE};
+	VkPipeline m_cullPipeline{VK_NULL_HANDLE};
+
+	VkDescriptorSetLayout m_hizSetLayout{VK_NULL_HANDLE};
+	VkPipelineLayout m_hizLayout{VK_NULL_HANDLE};
+	VkPipeline m_hizPipeline{VK_NULL_HANDLE};
+
+	Output m_output{};
+	std::vector<CullRange> m_ranges;
+
+	// by RenderTarget::getId
+	std::unordered_map<uint32_t, Pyramid> m_pyramids;
+
+public:
+	GpuCuller(const GpuCuller&) = delete;
+	GpuCuller(GpuCuller&&) = delete;
+	GpuCuller& operator=(const GpuCuller&) = delete;
+	GpuCuller& operator=(GpuCuller&&) = delete;
+};
+
+}  // namespace etna
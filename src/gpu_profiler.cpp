@@ -0,0 +1,209 @@
+#include <fstream>
+#include "etna/gpu_profiler.hpp"
+#include "etna/engine.hpp"
+#include "json.hpp"
+
+using namespace etna;
+using namespace ignis;
+
+// quoted only when it holds a separator, a quote or a line break
+static std::string csvField(const std::string& text) {
+	if (text.find_first_of(",\"\r\n") == std::string::npos) {
+		return text;
+	}
+
+	std::string quoted{"\""};
+
+	for (const char c : text) {
+		quoted += c;
+
+		if (c == '"') {
+			quoted += '"';
+		}
+	}
+
+	return quoted + '"';
+}
+
+GpuProfiler::GpuProfiler(const CreateInfo& info) : m_info(info) {
+	assert(info.framesInFlight > 0 && info.maxScopes > 0);
+
+	// one extra slot: the window blit of a frame can still be running when
+	// the renderer reuses that frame's slot
+	m_slots.resize(info.framesInFlight + 1);
+
+	const VkQueryPoolCreateInfo poolInfo{
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = static_cast<uint32_t>(m_slots.size()) * info.maxScopes * 2,
+	};
+
+	if (vkCreateQueryPool(_device.getDevice(), &poolInfo, nullptr, &m_queryPool) !=
+		VK_SUCCESS) {
+		throw std::runtime_error("failed to create query pool");
+	}
+
+	VkPhysicalDeviceProperties properties{};
+	vkGetPhysicalDeviceProperties(_device.getPhysicalDevice(), &properties);
+
+	m_timestampPeriod = properties.limits.timestampPeriod;
+
+	engine::immediateSubmit([&](Command& cmd) {
+		vkCmdResetQueryPool(cmd.getHandle(), m_queryPool, 0, poolInfo.queryCount);
+	});
+}
+
+GpuProfiler::~GpuProfiler() {
+	engine::queueForRetirement([device = _device.getDevice(), pool = m_queryPool] {
+		vkDestroyQueryPool(device, pool, nullptr);
+	});
+}
+
+void GpuProfiler::beginFrame(Command& cmd) {
+	m_currentSlot = m_frameCount % m_slots.size();
+
+	Slot& slot = m_slots[m_currentSlot];
+
+	if (slot.recorded) {
+		collect(slot, m_currentSlot);
+	}
+
+	vkCmdResetQueryPool(cmd.getHandle(), m_queryPool,
+						m_currentSlot * m_info.maxScopes * 2, m_info.maxScopes * 2);
+
+	slot.frame = m_frameCount++;
+	slot.recorded = true;
+	slot.names.clear();
+	slot.depths.clear();
+	slot.openScopes = 0;
+}
+
+uint32_t GpuProfiler::beginScope(Command& cmd, const char* name) {
+	Slot& slot = m_slots[m_currentSlot];
+
+	if (!slot.recorded || slot.names.size() == m_info.maxScopes) {
+		return NO_SCOPE;
+	}
+
+	const uint32_t scope = static_cast<uint32_t>(slot.names.size());
+
+	slot.names.push_back(name);
+	slot.depths.push_back(slot.openScopes++);
+
+	vkCmdWriteTimestamp(cmd.getHandle(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+						m_queryPool, (m_currentSlot * m_info.maxScopes + scope) * 2);
+
+	return scope;
+}
+
+void GpuProfiler::endScope(Command& cmd, uint32_t scope) {
+	if (scope == NO_SCOPE) {
+		return;
+	}
+
+	Slot& slot = m_slots[m_currentSlot];
+	slot.openScopes--;
+
+	vkCmdWriteTimestamp(cmd.getHandle(), VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+						m_queryPool,
+						(m_currentSlot * m_info.maxScopes + scope) * 2 + 1);
+}
+
+void GpuProfiler::collect(Slot& slot, uint32_t slotIndex) {
+	const uint32_t scopeCount = static_cast<uint32_t>(slot.names.size());
+
+	if (scopeCount == 0) {
+		return;
+	}
+
+	// value + availability per query; unavailable scopes are dropped rather
+	// than waited on
+	struct QueryResult {
+		uint64_t value;
+		uint64_t available;
+	};
+
+	std::vector<QueryResult> results(scopeCount * 2);
+
+	vkGetQueryPoolResults(_device.getDevice(), m_queryPool,
+						  slotIndex * m_info.maxScopes * 2, scopeCount * 2,
+						  results.size() * sizeof(QueryResult), results.data(),
+						  sizeof(QueryResult),
+						  VK_QUERY_RESULT_64_BIT |
+							  VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+	GpuFrameResult frame{.frame = slot.frame};
+
+	for (uint32_t i{0}; i < scopeCount; i++) {
+		const QueryResult& begin = results[i * 2];
+		const QueryResult& end = results[i * 2 + 1];
+
+		if (!begin.available || !end.available) {
+			continue;
+		}
+
+		if (!m_hasEpoch) {
+			m_epoch = begin.value;
+			m_hasEpoch = true;
+		}
+
+		const double toMs = m_timestampPeriod / 1e6;
+
+		frame.scopes.push_back({
+			.name = slot.names[i],
+			.depth = slot.depths[i],
+			.startMs = static_cast<double>(begin.value - m_epoch) * toMs,
+			.durationMs = static_cast<double>(end.value - begin.value) * toMs,
+		});
+	}
+
+	m_history.push_back(std::move(frame));
+
+	if (m_history.size() > m_info.historySize) {
+		m_history.pop_front();
+	}
+}
+
+void GpuProfiler::writeCSV(const std::string& path) const {
+	std::ofstream file(path);
+
+	if (!file) {
+		throw std::runtime_error("failed to open " + path);
+	}
+
+	file << "frame,scope,depth,start_ms,duration_ms\n";
+
+	for (const GpuFrameResult& frame : m_history) {
+		for (const GpuScopeResult& scope : frame.scopes) {
+			file << frame.frame << ',' << csvField(scope.name) << ','
+				 << scope.depth << ',' << scope.startMs << ',' << scope.durationMs
+				 << '\n';
+		}
+	}
+}
+
+// complete events ("ph": "X") in microseconds, loadable in chrome://tracing
+// and Perfetto
+void GpuProfiler::writeChromeTrace(const std::string& path) const {
+	std::ofstream file(path);
+
+	if (!file) {
+		throw std::runtime_error("failed to open " + path);
+	}
+
+	file << "{\"traceEvents\": [\n"
+		 << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": 0, "
+			"\"args\": {\"name\": \"GPU\"}}";
+
+	for (const GpuFrameResult& frame : m_history) {
+		for (const GpuScopeResult& scope : frame.scopes) {
+			file << ",\n{\"name\": \"" << jsonEscape(scope.name)
+				 << "\", \"cat\": \"gpu\", \"ph\": \"X\", \"pid\": 0, \"tid\": 0, "
+				 << "\"ts\": " << scope.startMs * 1000.0
+				 << ", \"dur\": " << scope.durationMs * 1000.0
+				 << ", \"args\": {\"frame\": " << frame.frame << "}}";
+		}
+	}
+
+	file << "\n]}\n";
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+namespace etna {
+
+// escapes a string for use between quotes in the JSON exporters
+inline std::string jsonEscape(const std::string& text) {
+	std::string escaped;
+
+	for (const char c : text) {
+		if (c == '"' || c == '\\') {
+			escaped += '\\';
+			escaped += c;
+		} else if (static_cast<unsigned char>(c) < 0x20) {
+			char code[7];
+			std::snprintf(code, sizeof(code), "\\u%04x", c);
+			escaped += code;
+		} else {
+			escaped += c;
+		}
+	}
+
+	return escaped;
+}
+
+}  // namespace etna
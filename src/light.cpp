@@ -10,11 +10,12 @@ DirectionalLight::DirectionalLight(const CreateInfo& info) : m_info(info) {
 		.color = info.color,
 	};
 
-	m_buffer = _device.createUBO(sizeof(DirectionalLightData), &lightData);
+	m_buffer = engine::allocateUniform(lightData,
+									   engine::MemoryCategory::OBJECT_UBO);
 }
 
 DirectionalLight::~DirectionalLight() {
-	_device.destroyBuffer(m_buffer);
+	engine::freeUniform(m_buffer, engine::MemoryCategory::OBJECT_UBO);
 }
 
 void DirectionalLight::update(const CreateInfo& info) {
@@ -24,7 +25,7 @@ void DirectionalLight::update(const CreateInfo& info) {
 		.color = info.color,
 	};
 
-	_device.updateBuffer(m_buffer, &lightData);
+	engine::updateUniform(m_buffer, lightData);
 }
 
 void DirectionalLight::updateDirection(const Vec3& direction) {
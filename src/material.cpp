@@ -1,22 +1,107 @@
+#include <atomic>
+#include <stdexcept>
+#include <unordered_map>
 #include "etna/material.hpp"
 #include "etna/engine.hpp"
 
 using namespace ignis;
 using namespace etna;
 
-MaterialTemplate::MaterialTemplate(const CreateInfo& info) {
+namespace {
+
+struct StateKeyHash {
+	size_t operator()(const MaterialTemplate::StateKey& key) const {
+		size_t seed{0};
+
+		auto combine = [&seed](size_t value) {
+			seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+		};
+
+		for (const auto& shader : key.shaders) {
+			combine(std::hash<std::string>{}(shader));
+		}
+
+		for (const auto* code : key.rawShaders) {
+			combine(std::hash<const void*>{}(code));
+		}
+
+		combine(key.enableDepth);
+		combine(key.transparency);
+		combine(key.polygonMode);
+		combine(std::hash<float>{}(key.lineWidth));
+		combine(key.samples);
+		combine(key.autoInstancing);
+
+		return seed;
+	}
+};
+
+using TemplateRegistry = std::unordered_map<MaterialTemplate::StateKey,
+										   std::weak_ptr<MaterialTemplate>,
+										   StateKeyHash>;
+
+std::atomic<uint32_t> g_nextTemplateId{0};
+std::atomic<uint32_t> g_nextMaterialId{0};
+
+}
+
+// never destroyed: templates held by other statics are released during
+// static destruction, possibly after this file's objects are gone
+static TemplateRegistry& templates() {
+	static TemplateRegistry* registry = new TemplateRegistry;
+	return *registry;
+}
+
+static MaterialTemplate::StateKey makeStateKey(
+	const MaterialTemplate::CreateInfo& info) {
+	MaterialTemplate::StateKey key{
+		.shaders = info.shaders,
+		.enableDepth = info.enableDepth,
+		.transparency = info.transparency,
+		.polygonMode = info.polygonMode,
+		.lineWidth = info.lineWidth,
+		.samples = engine::clampSampleCount(info.samples),
+		.autoInstancing = info.autoInstancing,
+	};
+
+	// embedded shaders live for the whole program, their address is their
+	// identity
+	for (const auto& shader : info.rawShaders) {
+		key.rawShaders.push_back(shader.code);
+	}
+
+	return key;
+}
+
+// the arena strides blocks by 16 bytes, a std430 array of a smaller struct
+// would be strided by its own size and read the wrong slots
+static void checkParamsSize(size_t size) {
+	if (size % 16 != 0) {
+		throw std::runtime_error(
+			"material params must be a multiple of 16 bytes, pad the struct");
+	}
+}
+
+MaterialTemplate::MaterialTemplate(const CreateInfo& info)
+	: m_key(makeStateKey(info)), m_id(g_nextTemplateId++) {
 	for (const auto& shaderPath : info.shaders) {
-		m_shaders.push_back(engine::newShader(shaderPath));
+		m_shaders.push_back(engine::getShader(shaderPath));
 	}
 
 	for (const auto& shader : info.rawShaders) {
 		m_shaders.push_back(
-			engine::newShader(shader.code, shader.size, shader.stage));
+			engine::getShader(shader.code, shader.size, shader.stage));
+	}
+
+	std::vector<Shader*> shaders;
+
+	for (const auto& shader : m_shaders) {
+		shaders.push_back(shader.get());
 	}
 
 	PipelineCreateInfo pipelineInfo{
 		.device = &_device,
-		.shaders = m_shaders,
+		.shaders = shaders,
 		.colorFormat = engine::COLOR_FORMAT,
 		.cullMode = VK_CULL_MODE_NONE,
 		.polygonMode = info.polygonMode,
@@ -26,6 +111,10 @@ MaterialTemplate::MaterialTemplate(const CreateInfo& info) {
 		.sampleShadingEnable = _device.isFeatureEnabled("SampleRateShading"),
 	};
 
+#ifdef ETNA_IGNIS_PIPELINE_CACHE
+	pipelineInfo.pipelineCache = engine::getPipelineCache();
+#endif
+
 	if (info.polygonMode != VK_POLYGON_MODE_FILL &&
 		!_device.isFeatureEnabled("FillModeNonSolid")) {
 		pipelineInfo.polygonMode = VK_POLYGON_MODE_FILL;
@@ -45,45 +134,90 @@ MaterialTemplate::MaterialTemplate(const CreateInfo& info) {
 		pipelineInfo.colorBlendOp = VK_BLEND_OP_ADD;
 	}
 
-	m_pipeline = new Pipeline(pipelineInfo);
+	if (!info.async) {
+		m_pipeline = new Pipeline(pipelineInfo);
+		return;
+	}
+
+	// shader modules are created above on the calling thread, only the
+	// pipeline itself is built on a worker; the destructor waits for it
+	m_compile = engine::runAsync([this, pipelineInfo] {
+		m_pipeline.store(new Pipeline(pipelineInfo), std::memory_order_release);
+	});
 }
 
 MaterialTemplate::~MaterialTemplate() {
-	for (ignis::Shader* shader : m_shaders) {
-		delete shader;
+	// a failed compile has nothing to release
+	if (m_compile.valid()) {
+		m_compile.wait();
 	}
 
-	delete m_pipeline;
+	auto it = templates().find(m_key);
+
+	if (it != templates().end() && it->second.expired()) {
+		templates().erase(it);
+	}
+
+	// modules are shared with other templates, dropping our references is
+	// enough
+	engine::queueForRetirement(
+		[shaders = m_shaders, pipeline = m_pipeline.load()] { delete pipeline; });
+}
+
+void MaterialTemplate::waitReady() {
+	if (m_compile.valid()) {
+		m_compile.get();
+	}
 }
 
 MaterialTemplateHandle MaterialTemplate::create(const CreateInfo& info) {
-	return std::shared_ptr<MaterialTemplate>(new MaterialTemplate(info));
+	const StateKey key = makeStateKey(info);
+
+	auto it = templates().find(key);
+
+	if (it != templates().end()) {
+		if (MaterialTemplateHandle existing = it->second.lock()) {
+			if (!info.async) {
+				existing->waitReady();
+			}
+
+			return existing;
+		}
+	}
+
+	MaterialTemplateHandle handle(new MaterialTemplate(info));
+
+	templates()[key] = handle;
+
+	return handle;
 }
 
 Material::Material(const CreateInfo& info)
-	: m_materialTemplate(info.templateHandle) {
+	: m_id(g_nextMaterialId++), m_materialTemplate(info.templateHandle) {
 	if (!info.paramsSize) {
 		return;
 	}
 
-	m_paramsUBO = _device.createUBO(info.paramsSize, info.params);
+	checkParamsSize(info.paramsSize);
+
+	m_paramsSize = info.paramsSize;
+	m_paramsUBO = engine::allocateUniform(info.paramsSize, info.params,
+										  engine::MemoryCategory::MATERIAL_PARAMS);
 }
 
-Material::Material(const MaterialTemplate::CreateInfo& info, size_t paramsSize) {
-	m_materialTemplate = MaterialTemplate::create({
-		.shaders = info.shaders,
-		.rawShaders = info.rawShaders,
-		.enableDepth = info.enableDepth,
-		.transparency = info.transparency,
-		.polygonMode = info.polygonMode,
-		.lineWidth = info.lineWidth,
-	});
+Material::Material(const MaterialTemplate::CreateInfo& info, size_t paramsSize)
+	: m_id(g_nextMaterialId++),
+	  m_materialTemplate(MaterialTemplate::create(info)) {
 
 	if (!paramsSize) {
 		return;
 	}
 
-	m_paramsUBO = _device.createUBO(paramsSize);
+	checkParamsSize(paramsSize);
+
+	m_paramsSize = paramsSize;
+	m_paramsUBO = engine::allocateUniform(paramsSize, nullptr,
+										  engine::MemoryCategory::MATERIAL_PARAMS);
 }
 
 MaterialHandle Material::create(const CreateInfo& info) {
@@ -95,9 +229,9 @@ MaterialHandle Material::create(const MaterialTemplate::CreateInfo& info) {
 }
 
 Material::~Material() {
-	_device.destroyBuffer(m_paramsUBO);
+	engine::freeUniform(m_paramsUBO, engine::MemoryCategory::MATERIAL_PARAMS);
 }
 
 void Material::updateParams(const void* data) const {
-	_device.updateBuffer(m_paramsUBO, data);
+	engine::updateUniform(m_paramsUBO, data, m_paramsSize);
 }
@@ -0,0 +1,169 @@
+#include <cstring>
+#include <sstream>
+#include "etna/memory.hpp"
+#include "etna/engine.hpp"
+
+using namespace etna;
+
+namespace {
+
+std::array<VkDeviceSize, engine::MEMORY_CATEGORY_COUNT> g_categoryBytes{};
+VkDeviceSize g_totalBytes{0};
+
+VkDeviceSize g_threshold{0};
+bool g_thresholdCrossed{false};
+std::function<void(const engine::MemoryReport&)> g_thresholdCallback;
+
+}
+
+static bool supportsMemoryBudget() {
+	static const bool supported = [] {
+		VkPhysicalDevice physicalDevice = _device.getPhysicalDevice();
+
+		uint32_t count{0};
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count,
+											 nullptr);
+
+		std::vector<VkExtensionProperties> extensions(count);
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count,
+											 extensions.data());
+
+		for (const auto& extension : extensions) {
+			if (!std::strcmp(extension.extensionName,
+							 VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+				return true;
+			}
+		}
+
+		return false;
+	}();
+
+	return supported;
+}
+
+const char* engine::getMemoryCategoryName(MemoryCategory category) {
+	switch (category) {
+		case MemoryCategory::MESH:
+			return "meshes";
+		case MemoryCategory::MATERIAL_PARAMS:
+			return "material params";
+		case MemoryCategory::INSTANCE_BUFFER:
+			return "instance buffers";
+		case MemoryCategory::RENDER_TARGET:
+			return "render targets";
+		case MemoryCategory::OBJECT_UBO:
+			return "object ubos";
+		case MemoryCategory::STAGING:
+			return "staging";
+		default:
+			return "untracked";
+	}
+}
+
+void engine::trackMemory(MemoryCategory category, int64_t bytes) {
+	if (category == MemoryCategory::UNTRACKED || bytes == 0) {
+		return;
+	}
+
+	g_categoryBytes[static_cast<size_t>(category)] += bytes;
+	g_totalBytes += bytes;
+
+	if (g_thresholdCallback == nullptr) {
+		return;
+	}
+
+	if (g_totalBytes < g_threshold) {
+		g_thresholdCrossed = false;
+		return;
+	}
+
+	if (!g_thresholdCrossed) {
+		g_thresholdCrossed = true;
+		g_thresholdCallback(getMemoryReport());
+	}
+}
+
+void engine::trackBuffer(ignis::BufferId buffer, MemoryCategory category) {
+	if (buffer == IGNIS_INVALID_BUFFER_ID) {
+		return;
+	}
+
+	trackMemory(category, _device.getBuffer(buffer).getSize());
+}
+
+engine::MemoryReport engine::getMemoryReport() {
+	MemoryReport report{
+		.bytes = g_categoryBytes,
+		.total = g_totalBytes,
+		.hasBudget = supportsMemoryBudget(),
+	};
+
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budget{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+	};
+
+	VkPhysicalDeviceMemoryProperties2 properties{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+		.pNext = report.hasBudget ? &budget : nullptr,
+	};
+
+	vkGetPhysicalDeviceMemoryProperties2(_device.getPhysicalDevice(), &properties);
+
+	const auto& memory = properties.memoryProperties;
+
+	for (uint32_t i{0}; i < memory.memoryHeapCount; i++) {
+		report.heaps.push_back({
+			.size = memory.memoryHeaps[i].size,
+			.budget = report.hasBudget ? budget.heapBudget[i] : 0,
+			.usage = report.hasBudget ? budget.heapUsage[i] : 0,
+			.deviceLocal =
+				(memory.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0,
+		});
+	}
+
+	return report;
+}
+
+std::string engine::formatMemoryReport(const MemoryReport& report) {
+	constexpr double MB{1024.0 * 1024.0};
+
+	std::ostringstream out;
+	out.precision(2);
+	out << std::fixed;
+
+	for (size_t i{0}; i < MEMORY_CATEGORY_COUNT; i++) {
+		out << getMemoryCategoryName(static_cast<MemoryCategory>(i)) << ": "
+			<< report.bytes[i] / MB << " MB\n";
+	}
+
+	out << "total: " << report.total / MB << " MB\n";
+
+	for (size_t i{0}; i < report.heaps.size(); i++) {
+		const HeapBudget& heap = report.heaps[i];
+
+		out << "heap " << i << (heap.deviceLocal ? " (device local)" : "") << ": "
+			<< heap.size / MB << " MB";
+
+		if (report.hasBudget) {
+			out << ", using " << heap.usage / MB << " of " << heap.budget / MB
+				<< " MB budget";
+		}
+
+		out << "\n";
+	}
+
+	return out.str();
+}
+
+void engine::setMemoryThreshold(VkDeviceSize threshold,
+								std::function<void(const MemoryReport&)> callback) {
+	g_threshold = threshold;
+	g_thresholdCallback = std::move(callback);
+	g_thresholdCrossed = false;
+
+	// already over it: report right away
+	if (g_thresholdCallback != nullptr && g_totalBytes >= g_threshold) {
+		g_thresholdCrossed = true;
+		g_thresholdCallback(getMemoryReport());
+	}
+}
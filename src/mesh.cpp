@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <atomic>
 #include "etna/mesh.hpp"
 #include "ignis/command.hpp"
 #include "etna/engine.hpp"
@@ -5,24 +7,118 @@
 using namespace etna;
 using namespace ignis;
 
+namespace {
+
+std::atomic<uint32_t> g_nextId{0};
+std::atomic<uint64_t> g_boundsEpoch{0};
+
+}
+
 Mesh::Mesh(const CreateInfo& info)
-	: m_vertexBuffer(_device.createSSBO(info.vertices.size() * sizeof(Vertex))) {
+	: m_id(g_nextId++),
+	  m_raycast(info.raycast),
+	  m_vertexBuffer(_device.createSSBO(info.vertices.size() * sizeof(Vertex))) {
 	m_indexBuffer = new Buffer(_device.createIndexBuffer32(info.indices.size()));
+
+	engine::trackBuffer(m_vertexBuffer, engine::MemoryCategory::MESH);
+	engine::trackMemory(engine::MemoryCategory::MESH, m_indexBuffer->getSize());
+
 	update(info);
 }
 
 Mesh::~Mesh() {
-	_device.destroyBuffer(m_vertexBuffer);
-	delete m_indexBuffer;
-}
+	engine::retireBuffer(m_vertexBuffer, engine::MemoryCategory::MESH);
 
-void Mesh::update(const CreateInfo& info) {
-	engine::immediateSubmit([&](Command& cmd) {
-		cmd.updateBuffer(m_vertexBuffer, info.vertices.data());
-		cmd.updateBuffer(*m_indexBuffer, info.indices.data());
+	engine::queueForRetirement([indexBuffer = m_indexBuffer] {
+		engine::trackMemory(engine::MemoryCategory::MESH,
+							-int64_t(indexBuffer->getSize()));
+		delete indexBuffer;
 	});
 }
 
+engine::CompletionToken Mesh::update(const CreateInfo& info) {
+	const AABB bounds = m_bounds;
+
+	computeBounds(info.vertices);
+
+	if (m_bounds.min != bounds.min || m_bounds.max != bounds.max) {
+		m_boundsVersion++;
+		g_boundsEpoch.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	if (m_raycast) {
+		m_positions.resize(info.vertices.size());
+
+		for (uint32_t i{0}; i < info.vertices.size(); i++) {
+			m_positions[i] = info.vertices[i].position;
+		}
+
+		m_indices = info.indices;
+		m_triangleBvh.reset();
+		m_triangleBvhReady.store(false, std::memory_order_release);
+	}
+
+	engine::upload(m_vertexBuffer, info.vertices.data());
+	m_uploadToken = engine::upload(*m_indexBuffer, info.indices.data());
+
+	return m_uploadToken;
+}
+
+// the sphere is centered on the box rather than minimal, which is close
+// enough for culling and a single pass over the vertices
+void Mesh::computeBounds(const std::vector<Vertex>& vertices) {
+	if (vertices.empty()) {
+		m_bounds = {};
+		m_sphere = {};
+		return;
+	}
+
+	m_bounds = {.min = vertices[0].position, .max = vertices[0].position};
+
+	for (const Vertex& vertex : vertices) {
+		for (uint32_t i{0}; i < 3; i++) {
+			m_bounds.min[i] = std::min(m_bounds.min[i], vertex.position[i]);
+			m_bounds.max[i] = std::max(m_bounds.max[i], vertex.position[i]);
+		}
+	}
+
+	const Vec3 center = m_bounds.center();
+
+	float radius{0};
+
+	for (const Vertex& vertex : vertices) {
+		radius = std::max(radius, Vec3(vertex.position - center).length());
+	}
+
+	m_sphere = {.center = center, .radius = radius};
+}
+
+const TriangleBvh& Mesh::getTriangleBvh() const {
+	assert(m_raycast && "Mesh not created with raycast");
+
+	if (m_triangleBvhReady.load(std::memory_order_acquire)) {
+		return *m_triangleBvh;
+	}
+
+	std::lock_guard lock(m_triangleBvhMutex);
+
+	if (!m_triangleBvhReady.load(std::memory_order_relaxed)) {
+		m_triangleBvh = std::make_unique<TriangleBvh>(m_positions, m_indices);
+
+		// the tree keeps its own copy of the triangles
+		m_positions = {};
+		m_indices = {};
+
+		m_triangleBvhReady.store(true, std::memory_order_release);
+	}
+
+	return *m_triangleBvh;
+}
+
+uint64_t Mesh::getBoundsEpoch() {
+	return g_boundsEpoch.load(std::memory_order_relaxed);
+}
+
 MeshHandle Mesh::create(const CreateInfo& info) {
 	return std::shared_ptr<Mesh>(new Mesh(info));
 }
@@ -0,0 +1,304 @@
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include "etna/render_queue.hpp"
+#include "etna/trace.hpp"
+
+using namespace etna;
+
+namespace {
+
+// opaque key, from the most significant bits down; ids wrap around, which
+// only costs some batching when a scene has more of them than fit
+constexpr uint32_t PIPELINE_BITS{14};
+constexpr uint32_t MATERIAL_BITS{20};
+constexpr uint32_t MESH_BITS{18};
+constexpr uint32_t DEPTH_BITS{12};
+
+static_assert(PIPELINE_BITS + MATERIAL_BITS + MESH_BITS + DEPTH_BITS == 64);
+
+// below this a comparison sort is faster than the radix passes
+constexpr size_t RADIX_SORT_THRESHOLD{64};
+
+}
+
+static uint64_t field(uint32_t value, uint32_t bits, uint32_t shift) {
+	return (static_cast<uint64_t>(value) & ((1ull << bits) - 1)) << shift;
+}
+
+// LSD radix sort, 8 bits per pass and stable; a pass where every key has the
+// same byte would not move anything and is skipped, so the unused low bits
+// of the transparent keys cost nothing
+template <typename Packet>
+static void radixSort(std::vector<Packet>& packets, std::vector<Packet>& scratch) {
+	const size_t count = packets.size();
+
+	if (count < RADIX_SORT_THRESHOLD) {
+		std::stable_sort(packets.begin(), packets.end(),
+						 [](const Packet& a, const Packet& b) {
+							 return a.key < b.key;
+						 });
+		return;
+	}
+
+	uint32_t histograms[8][256]{};
+
+	for (const Packet& packet : packets) {
+		for (uint32_t pass{0}; pass < 8; pass++) {
+			histograms[pass][(packet.key >> (pass * 8)) & 0xFF]++;
+		}
+	}
+
+	scratch.resize(count);
+
+	for (uint32_t pass{0}; pass < 8; pass++) {
+		const uint32_t shift = pass * 8;
+		uint32_t* offsets = histograms[pass];
+
+		if (offsets[(packets[0].key >> shift) & 0xFF] == count) {
+			continue;
+		}
+
+		uint32_t offset{0};
+
+		for (uint32_t i{0}; i < 256; i++) {
+			const uint32_t bucketCount = offsets[i];
+			offsets[i] = offset;
+			offset += bucketCount;
+		}
+
+		for (const Packet& packet : packets) {
+			scratch[offsets[(packet.key >> shift) & 0xFF]++] = packet;
+		}
+
+		packets.swap(scratch);
+	}
+}
+
+static bool canInstance(const DrawSettings& draw) {
+	const MaterialTemplate& materialTemplate = draw.material->getTemplate();
+
+	return draw.instanceCount == 1 &&
+		   draw.instanceBuffer == IGNIS_INVALID_BUFFER_ID &&
+		   draw.drawData == IGNIS_INVALID_BUFFER_ID &&
+		   materialTemplate.allowsAutoInstancing() && materialTemplate.isReady();
+}
+
+// indirect batches only need to share the pipeline, the material of every
+// draw comes from its record
+static bool sameBatch(const DrawSettings& a, const DrawSettings& b, bool indirect) {
+	const bool sameMaterial =
+		indirect ? &a.material->getTemplate() == &b.material->getTemplate()
+				 : a.material == b.material;
+
+	return sameMaterial && a.mesh == b.mesh && canInstance(b) &&
+		   a.buff1 == b.buff1 && a.buff2 == b.buff2 && a.buff3 == b.buff3 &&
+		   a.viewport.x == b.viewport.x && a.viewport.y == b.viewport.y &&
+		   a.viewport.width == b.viewport.width &&
+		   a.viewport.height == b.viewport.height;
+}
+
+void RenderQueue::clear() {
+	m_draws.clear();
+	m_depths.clear();
+	m_bounds.clear();
+}
+
+void RenderQueue::push(const DrawSettings& settings,
+					   float depth,
+					   const BoundingSphere& bounds) {
+	assert(settings.mesh != nullptr && settings.material != nullptr);
+
+	m_draws.push_back(settings);
+	m_depths.push_back(depth);
+	m_bounds.push_back(bounds);
+}
+
+void RenderQueue::submit(Renderer& renderer, const QueueSubmitInfo& info) {
+	ETNA_TRACE_SCOPE("RenderQueue::submit");
+
+	const bool indirect = info.indirect;
+
+	m_opaque.clear();
+	m_transparent.clear();
+
+	float minDepth{std::numeric_limits<float>::max()};
+	float maxDepth{std::numeric_limits<float>::lowest()};
+
+	for (uint32_t i{0}; i < m_draws.size(); i++) {
+		const float depth = m_depths[i];
+
+		if (!m_draws[i].material->getTemplate().isTransparent()) {
+			minDepth = std::min(minDepth, depth);
+			maxDepth = std::max(maxDepth, depth);
+
+			m_opaque.push_back({.draw = i});
+			continue;
+		}
+
+		// positive floats order like their bits; inverted for back-to-front
+		const uint32_t depthBits = std::bit_cast<uint32_t>(std::max(depth, 0.f));
+
+		m_transparent.push_back({
+			.key = static_cast<uint64_t>(~depthBits) << 32,
+			.draw = i,
+		});
+	}
+
+	// opaque depth is quantized over the range this frame actually uses
+	const float depthScale =
+		maxDepth > minDepth ? ((1u << DEPTH_BITS) - 1) / (maxDepth - minDepth) : 0;
+
+	// indirect batches are per pipeline and mesh, so the mesh goes before
+	// the material there
+	const uint32_t meshShift = indirect ? MATERIAL_BITS + DEPTH_BITS : DEPTH_BITS;
+	const uint32_t materialShift = indirect ? DEPTH_BITS : MESH_BITS + DEPTH_BITS;
+
+	for (SortPacket& packet : m_opaque) {
+		const DrawSettings& draw = m_draws[packet.draw];
+
+		const uint32_t depth =
+			static_cast<uint32_t>((m_depths[packet.draw] - minDepth) * depthScale);
+
+		packet.key = field(draw.material->getTemplate().getId(), PIPELINE_BITS,
+						   MATERIAL_BITS + MESH_BITS + DEPTH_BITS) |
+					 field(draw.material->getId(), MATERIAL_BITS, materialShift) |
+					 field(draw.mesh->getId(), MESH_BITS, meshShift) |
+					 field(depth, DEPTH_BITS, 0);
+	}
+
+	radixSort(m_opaque, m_scratch);
+	radixSort(m_transparent, m_scratch);
+
+	buildBatches(indirect);
+
+	Renderer::FrameStorage records{IGNIS_INVALID_BUFFER_ID, 0};
+
+	if (!m_records.empty()) {
+		records = renderer.allocateFrameStorage(
+			m_records.size() * sizeof(engine::DrawRecord), m_records.data(),
+			sizeof(engine::DrawRecord));
+	}
+
+	// one command per draw, so each can be culled on its own
+	m_commands.clear();
+	m_commandBounds.clear();
+	m_cullRanges.clear();
+
+	for (Batch& batch : m_batches) {
+		if (!batch.indirect) {
+			continue;
+		}
+
+		const MeshHandle& mesh = m_draws[m_opaque[batch.packet].draw].mesh;
+
+		batch.firstCommand = static_cast<uint32_t>(m_commands.size());
+		batch.range = static_cast<uint32_t>(m_cullRanges.size());
+
+		for (uint32_t i{0}; i < batch.count; i++) {
+			m_commands.push_back({
+				.indexCount = mesh->indexCount(),
+				.instanceCount = 1,
+				.firstIndex = 0,
+				.vertexOffset = 0,
+				.firstInstance = records.first + batch.firstRecord + i,
+			});
+
+			m_commandBounds.push_back(m_bounds[m_opaque[batch.packet + i].draw]);
+		}
+
+		m_cullRanges.push_back({batch.firstCommand, batch.count});
+	}
+
+	const bool gpuCulling =
+		info.cullView && renderer.hasGpuCulling() && !m_cullRanges.empty();
+
+	const std::span<const VkDrawIndexedIndirectCommand> commands{m_commands};
+
+	constexpr uint32_t NO_CULL_RANGE = IndirectDrawSettings::NO_CULL_RANGE;
+
+	if (gpuCulling) {
+		renderer.cullIndirect(m_commands, m_commandBounds, m_cullRanges,
+							  *info.cullView);
+	}
+
+	for (const Batch& batch : m_batches) {
+		const DrawSettings& first = m_draws[m_opaque[batch.packet].draw];
+
+		if (batch.count == 1 && !batch.indirect) {
+			renderer.draw(first);
+			continue;
+		}
+
+		if (!batch.indirect) {
+			DrawSettings draw = first;
+			draw.instanceCount = batch.count;
+			draw.drawData = records.buffer;
+			draw.firstInstance = records.first + batch.firstRecord;
+
+			renderer.draw(draw);
+			continue;
+		}
+
+		renderer.drawIndirect({
+			.mesh = first.mesh,
+			.material = first.material,
+			.viewport = first.viewport,
+			.buff1 = first.buff1,
+			.buff2 = first.buff2,
+			.buff3 = first.buff3,
+			.drawData = records.buffer,
+			.commands = commands.subspan(batch.firstCommand, batch.count),
+			.cullRange = gpuCulling ? batch.range : NO_CULL_RANGE,
+		});
+	}
+
+	for (const SortPacket& packet : m_transparent) {
+		renderer.draw(m_draws[packet.draw]);
+	}
+}
+
+// the sort keys put draws of the same template, material and mesh next to
+// each other, so batches are runs of consecutive packets
+void RenderQueue::buildBatches(bool indirect) {
+	m_batches.clear();
+	m_records.clear();
+
+	for (uint32_t i{0}; i < m_opaque.size();) {
+		const DrawSettings& first = m_draws[m_opaque[i].draw];
+
+		uint32_t end{i + 1};
+
+		const bool instanced = canInstance(first);
+
+		if (instanced) {
+			while (end < m_opaque.size() &&
+				   sameBatch(first, m_draws[m_opaque[end].draw], indirect)) {
+				end++;
+			}
+		}
+
+		const uint32_t count = end - i;
+
+		m_batches.push_back({
+			.packet = i,
+			.count = count,
+			.firstRecord = static_cast<uint32_t>(m_records.size()),
+			.indirect = indirect && instanced,
+		});
+
+		if (count > 1 || m_batches.back().indirect) {
+			for (uint32_t j{i}; j < end; j++) {
+				const DrawSettings& draw = m_draws[m_opaque[j].draw];
+
+				m_records.push_back({
+					.model = draw.transform,
+					.material = draw.material->getParamsUBO(),
+					.vertices = draw.mesh->getVertexBuffer(),
+				});
+			}
+		}
+
+		i = end;
+	}
+}
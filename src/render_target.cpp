@@ -1,10 +1,14 @@
+#include <atomic>
 #include "etna/engine.hpp"
 #include "etna/render_target.hpp"
 
 using namespace ignis;
 using namespace etna;
 
-RenderTarget::RenderTarget(const CreateInfo& info) : m_creationInfo(info) {
+static std::atomic<uint32_t> g_nextTargetId{0};
+
+RenderTarget::RenderTarget(const CreateInfo& info)
+	: m_id(g_nextTargetId++), m_creationInfo(info) {
 	const uint32_t sampleCount{engine::clampSampleCount(info.samples)};
 	m_creationInfo.samples = sampleCount;
 
@@ -31,6 +35,18 @@ RenderTarget::RenderTarget(const CreateInfo& info) : m_creationInfo(info) {
 		.sampleCount = static_cast<VkSampleCountFlagBits>(sampleCount),
 	}));
 
+	// ignis doesn't expose the allocations, so estimate from the formats:
+	// RGBA16 color and D32 depth
+	const VkDeviceSize pixels = VkDeviceSize(info.extent.width) * info.extent.height;
+
+	m_memoryBytes = pixels * sampleCount * (8 + 4);
+
+	if (isMultiSampled()) {
+		m_memoryBytes += pixels * 8;
+	}
+
+	engine::trackMemory(engine::MemoryCategory::RENDER_TARGET, m_memoryBytes);
+
 	etna::engine::immediateSubmit([&](ignis::Command& cmd) {
 		cmd.transitionToOptimalLayout(*m_drawImage);
 
@@ -42,7 +58,14 @@ RenderTarget::RenderTarget(const CreateInfo& info) : m_creationInfo(info) {
 }
 
 RenderTarget::~RenderTarget() {
-	delete m_drawImage;
-	delete m_depthImage;
-	delete m_resolvedImage;
+	engine::queueForRetirement([drawImage = m_drawImage, depthImage = m_depthImage,
+								resolvedImage = m_resolvedImage,
+								memoryBytes = m_memoryBytes] {
+		engine::trackMemory(engine::MemoryCategory::RENDER_TARGET,
+							-int64_t(memoryBytes));
+
+		delete drawImage;
+		delete depthImage;
+		delete resolvedImage;
+	});
 }
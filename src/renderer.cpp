@@ -1,11 +1,63 @@
+#include <algorithm>
+#include <cstring>
 #include "etna/renderer.hpp"
 #include "etna/engine.hpp"
+#include "etna/default_materials.hpp"
 #include "ignis/fence.hpp"
+#include "stats.hpp"
+#include "etna/trace.hpp"
+#include "gpu_culler.hpp"
 
 using namespace etna;
 using namespace ignis;
 
-Renderer::Renderer(const CreateInfo& info) : m_framesInFlight(info.framesInFlight) {
+static bool sameViewport(const VkViewport& a, const VkViewport& b) {
+	return a.x == b.x && a.y == b.y && a.width == b.width &&
+		   a.height == b.height && a.minDepth == b.minDepth &&
+		   a.maxDepth == b.maxDepth;
+}
+
+// smallest run of 4 byte words covering every difference between a and b;
+// size is 0 when they are equal
+static void changedRange(const engine::PushConstants& a,
+						 const engine::PushConstants& b,
+						 uint32_t& offset,
+						 uint32_t& size) {
+	static_assert(sizeof(engine::PushConstants) % 4 == 0);
+
+	constexpr uint32_t WORDS{sizeof(engine::PushConstants) / 4};
+
+	uint32_t wordsA[WORDS];
+	uint32_t wordsB[WORDS];
+
+	std::memcpy(wordsA, &a, sizeof(a));
+	std::memcpy(wordsB, &b, sizeof(b));
+
+	uint32_t first{0};
+
+	while (first < WORDS && wordsA[first] == wordsB[first]) {
+		first++;
+	}
+
+	if (first == WORDS) {
+		offset = size = 0;
+		return;
+	}
+
+	uint32_t last{WORDS - 1};
+
+	while (wordsA[last] == wordsB[last]) {
+		last--;
+	}
+
+	offset = first * 4;
+	size = (last - first + 1) * 4;
+}
+
+Renderer::Renderer(const CreateInfo& info)
+	: m_framesInFlight(info.framesInFlight),
+	  m_elideState(info.elideRedundantState),
+	  m_profiler(info.profiler) {
 	assert(m_framesInFlight > 0);
 
 	m_frames.resize(m_framesInFlight);
@@ -14,26 +66,109 @@ Renderer::Renderer(const CreateInfo& info) : m_framesInFlight(info.framesInFligh
 		m_frames[i].inFlight = new Fence(_device.createFence());
 		m_frames[i].cmd = engine::newGraphicsCommand();
 	}
+
+	if (info.gpuCulling && supportsGpuCulling()) {
+		m_culler = new GpuCuller(m_framesInFlight);
+	}
 }
 
 Renderer::~Renderer() {
-	for (uint32_t i{0}; i < m_framesInFlight; i++) {
-		delete m_frames[i].inFlight;
-		delete m_frames[i].cmd;
+	for (FrameData& frame : m_frames) {
+		waitFrame(frame);
+
+		for (const FrameUBO& ubo : frame.ubos) {
+			engine::freeUniform(ubo.handle, engine::MemoryCategory::OBJECT_UBO);
+		}
+
+		for (const StorageChunk& chunk : frame.storage) {
+			engine::retireBuffer(chunk.buffer,
+								 engine::MemoryCategory::INSTANCE_BUFFER);
+		}
+
+		for (const IndirectChunk& chunk : frame.indirect) {
+			destroyIndirectChunk(chunk);
+		}
+
+		delete frame.inFlight;
+		delete frame.cmd;
 	}
+
+	delete m_culler;
+}
+
+void Renderer::waitFrame(FrameData& frame) {
+	if (!frame.submitted)
+		return;
+
+	engine::waitFence(*frame.inFlight);
+	frame.inFlight->reset();
+	frame.submitted = false;
+
+	engine::signalToken(frame.token);
 }
 
 void Renderer::beginFrame(const RenderTarget& target,
 						  const RenderFrameSettings& settings) {
+	ETNA_TRACE_SCOPE("Renderer::beginFrame");
+
 	Command& cmd = getCommand();
 	FrameData& frame = m_frames[m_currentFrame];
 
 	m_currTarget = &target;
 
-	frame.inFlight->reset();
+	// only block if the GPU is still using this slot from N frames ago
+	waitFrame(frame);
+
+	engine::retireResources();
+
+	engine::beginFrameRecording();
+
+	frame.usedUBOs = 0;
+
+	for (StorageChunk& chunk : frame.storage) {
+		chunk.used = 0;
+	}
+
+	frame.currentChunk = 0;
+
+	for (IndirectChunk& chunk : frame.indirect) {
+		chunk.used = 0;
+	}
+
+	frame.currentIndirect = 0;
+
+	if (m_culler != nullptr) {
+		m_culler->beginFrame(m_currentFrame);
+	}
+
+	// a fresh command buffer has nothing bound
+	m_bound = {};
+
+	m_frameSettings = settings;
+
+	ETNA_STAT(m_stats = {});
+	ETNA_STAT(m_transferBase = engine::getTransferCounters());
 
 	cmd.begin();
 
+	if (m_profiler != nullptr) {
+		m_profiler->beginFrame(cmd);
+		m_frameScope = m_profiler->beginScope(cmd, "frame");
+	}
+
+	RenderFrameSettings firstPass = settings;
+
+	// culling may suspend rendering, and the occlusion test of the next
+	// frame reads this one's depth
+	if (m_culler != nullptr) {
+		firstPass.colorStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
+		firstPass.depthStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
+	}
+
+	beginRendering(firstPass);
+}
+
+void Renderer::beginRendering(const RenderFrameSettings& settings) {
 	const VkClearColorValue clearColorValue{
 		{
 			settings.clearColor.r,
@@ -58,15 +193,28 @@ void Renderer::beginFrame(const RenderTarget& target,
 							   })
 							 : nullptr;
 
-	cmd.beginRender(drawAttachment, depthAttachment);
+	getCommand().beginRender(drawAttachment, depthAttachment);
 }
 
 void Renderer::endFrame() {
+	ETNA_TRACE_SCOPE("Renderer::endFrame");
+
 	Command& cmd = getCommand();
 
 	cmd.endRendering();
 
+	// multisampled depth would need a resolve first, so those targets are
+	// only frustum culled
+	if (m_culler != nullptr && m_frameSettings.renderDepth &&
+		!m_currTarget->isMultiSampled()) {
+		GpuScope scope(m_profiler, cmd, "hiz");
+
+		m_culler->buildHiZ(cmd, *m_currTarget);
+	}
+
 	if (m_currTarget->isMultiSampled()) {
+		GpuScope scope(m_profiler, cmd, "resolve");
+
 		ignis::Image& drawImage = *m_currTarget->getDrawImage();
 		ignis::Image& resolvedDrawImage = *m_currTarget->getResolvedImage();
 
@@ -80,58 +228,430 @@ void Renderer::endFrame() {
 		cmd.transitionToOptimalLayout(resolvedDrawImage);
 	}
 
+	if (m_profiler != nullptr) {
+		m_profiler->endScope(cmd, m_frameScope);
+	}
+
 	cmd.end();
 
 	const SubmitCmdInfo cmdInfo{.command = cmd};
 
-	_device.submitCommands({cmdInfo}, m_frames[m_currentFrame].inFlight);
+	FrameData& frame = m_frames[m_currentFrame];
+
+	// uploads recorded during the frame must execute before it
+	engine::flushUploads();
+
+	frame.token = engine::nextToken();
 
-	m_frames[m_currentFrame].inFlight->wait();
+	_device.submitCommands({cmdInfo}, frame.inFlight);
+
+	frame.submitted = true;
+
+	engine::endFrameRecording(frame.token);
 
 	m_currentFrame = (m_currentFrame + 1) % m_framesInFlight;
 }
 
-void Renderer::draw(const DrawSettings& settings) {
-	Command& cmd = getCommand();
+engine::UniformHandle Renderer::allocateFrameUBO(size_t size, const void* data) {
+	FrameData& frame = m_frames[m_currentFrame];
 
-	assert(settings.mesh != nullptr && "Mesh is null");
-	assert(settings.instanceCount > 0 && "Instance count is zero");
+	// the slot's blocks are reused positionally; a block of another size is
+	// replaced, so a scene requesting in a different order only costs an
+	// allocation
+	if (frame.usedUBOs == frame.ubos.size()) {
+		frame.ubos.push_back({
+			size,
+			engine::allocateUniform(size, data, engine::MemoryCategory::OBJECT_UBO),
+		});
+
+		return frame.ubos[frame.usedUBOs++].handle;
+	}
+
+	FrameUBO& ubo = frame.ubos[frame.usedUBOs++];
+
+	if (ubo.size != size) {
+		engine::freeUniform(ubo.handle, engine::MemoryCategory::OBJECT_UBO);
+
+		ubo = {
+			size,
+			engine::allocateUniform(size, data, engine::MemoryCategory::OBJECT_UBO),
+		};
+
+		return ubo.handle;
+	}
+
+	engine::updateUniform(ubo.handle, data, size);
+
+	return ubo.handle;
+}
+
+Renderer::FrameStorage Renderer::allocateFrameStorage(size_t size,
+													  const void* data,
+													  size_t stride) {
+	assert(size > 0 && stride > 0);
+
+	FrameData& frame = m_frames[m_currentFrame];
+
+	auto alignedOffset = [stride](VkDeviceSize used) {
+		return (used + stride - 1) / stride * stride;
+	};
+
+	// chunks stay around for the next frames; a request that doesn't fit
+	// moves on to the next one, or a new one twice the size
+	while (frame.currentChunk < frame.storage.size() &&
+		   alignedOffset(frame.storage[frame.currentChunk].used) + size >
+			   frame.storage[frame.currentChunk].size) {
+		frame.currentChunk++;
+	}
+
+	if (frame.currentChunk == frame.storage.size()) {
+		const VkDeviceSize chunkSize = std::max<VkDeviceSize>(
+			{engine::FRAME_STORAGE_CHUNK_SIZE, size,
+			 frame.storage.empty() ? 0 : frame.storage.back().size * 2});
+
+		const BufferId buffer = _device.createSSBO(chunkSize);
+		engine::trackBuffer(buffer, engine::MemoryCategory::INSTANCE_BUFFER);
+
+		frame.storage.push_back({buffer, chunkSize, 0});
+	}
+
+	StorageChunk& chunk = frame.storage[frame.currentChunk];
+
+	const VkDeviceSize offset = alignedOffset(chunk.used);
+	chunk.used = offset + size;
+
+	engine::updateBuffer(chunk.buffer, data, offset, size);
+
+	return {chunk.buffer, static_cast<uint32_t>(offset / stride)};
+}
+
+Renderer::IndirectChunk Renderer::createIndirectChunk(VkDeviceSize size) {
+	VkDevice device = _device.getDevice();
+
+	IndirectChunk chunk{.size = size, .used = 0};
+
+	const VkBufferCreateInfo bufferInfo{
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = size,
+		.usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	};
+
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &chunk.buffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create indirect buffer");
+	}
+
+	VkMemoryRequirements requirements{};
+	vkGetBufferMemoryRequirements(device, chunk.buffer, &requirements);
+
+	const uint32_t memoryType = engine::findMemoryType(
+		requirements.memoryTypeBits,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-	VkViewport vp{
-		.x = settings.viewport.x,
-		.y = settings.viewport.y,
-		.width = settings.viewport.width,
-		.height = settings.viewport.height,
+	const VkMemoryAllocateInfo allocInfo{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.allocationSize = requirements.size,
+		.memoryTypeIndex = memoryType,
+	};
+
+	if (memoryType == UINT32_MAX ||
+		vkAllocateMemory(device, &allocInfo, nullptr, &chunk.memory) !=
+			VK_SUCCESS) {
+		vkDestroyBuffer(device, chunk.buffer, nullptr);
+		throw std::runtime_error("failed to allocate indirect buffer memory");
+	}
+
+	if (vkBindBufferMemory(device, chunk.buffer, chunk.memory, 0) != VK_SUCCESS ||
+		vkMapMemory(device, chunk.memory, 0, VK_WHOLE_SIZE, 0, &chunk.mapped) !=
+			VK_SUCCESS) {
+		vkDestroyBuffer(device, chunk.buffer, nullptr);
+		vkFreeMemory(device, chunk.memory, nullptr);
+		throw std::runtime_error("failed to map indirect buffer memory");
+	}
+
+	engine::trackMemory(engine::MemoryCategory::INSTANCE_BUFFER, size);
+
+	return chunk;
+}
+
+void Renderer::destroyIndirectChunk(const IndirectChunk& chunk) {
+	VkDevice device = _device.getDevice();
+
+	vkDestroyBuffer(device, chunk.buffer, nullptr);
+	vkFreeMemory(device, chunk.memory, nullptr);
+
+	engine::trackMemory(engine::MemoryCategory::INSTANCE_BUFFER,
+						-int64_t(chunk.size));
+}
+
+Renderer::IndirectAllocation Renderer::allocateIndirect(VkDeviceSize size) {
+	FrameData& frame = m_frames[m_currentFrame];
+
+	// same scheme as allocateFrameStorage; commands are 4 byte aligned
+	while (frame.currentIndirect < frame.indirect.size() &&
+		   frame.indirect[frame.currentIndirect].used + size >
+			   frame.indirect[frame.currentIndirect].size) {
+		frame.currentIndirect++;
+	}
+
+	if (frame.currentIndirect == frame.indirect.size()) {
+		frame.indirect.push_back(createIndirectChunk(std::max<VkDeviceSize>(
+			{engine::FRAME_STORAGE_CHUNK_SIZE, size,
+			 frame.indirect.empty() ? 0 : frame.indirect.back().size * 2})));
+	}
+
+	IndirectChunk& chunk = frame.indirect[frame.currentIndirect];
+
+	const IndirectAllocation allocation{
+		.buffer = chunk.buffer,
+		.offset = chunk.used,
+		.mapped = static_cast<char*>(chunk.mapped) + chunk.used,
+	};
+
+	chunk.used += size;
+
+	return allocation;
+}
+
+void Renderer::bindState(ignis::Pipeline& pipeline,
+						 const Mesh& mesh,
+						 const Viewport& viewport) {
+	Command& cmd = getCommand();
+
+	const VkViewport vp{
+		.x = viewport.x,
+		.y = viewport.y,
+		.width = viewport.width,
+		.height = viewport.height,
 		.minDepth = 0.f,
 		.maxDepth = 1.f,
 	};
 
-	assert(settings.material != nullptr);
+	if (!m_elideState || m_bound.pipeline != &pipeline) {
+		cmd.bindPipeline(pipeline);
+		m_bound.pipeline = &pipeline;
+		ETNA_STAT(m_stats.pipelineBinds++);
+	} else {
+		ETNA_STAT(m_stats.skippedPipelineBinds++);
+	}
+
+	if (!m_elideState || !m_bound.viewport ||
+		!sameViewport(*m_bound.viewport, vp)) {
+		cmd.setViewport(vp);
+		m_bound.viewport = vp;
+	} else {
+		ETNA_STAT(m_stats.skippedStateSets++);
+	}
+
+	// the target, and so the scissor, stays the same for the whole frame
+	if (!m_elideState || !m_bound.scissor) {
+		cmd.setScissor(m_currTarget->getExtent().width,
+					   m_currTarget->getExtent().height);
+		m_bound.scissor = true;
+	} else {
+		ETNA_STAT(m_stats.skippedStateSets++);
+	}
+
+	const Buffer* indexBuffer = mesh.getIndexBuffer();
+
+	if (!m_elideState || m_bound.indexBuffer != indexBuffer) {
+		cmd.bindIndexBuffer(*indexBuffer);
+		m_bound.indexBuffer = indexBuffer;
+		ETNA_STAT(m_stats.indexBufferBinds++);
+	} else {
+		ETNA_STAT(m_stats.skippedIndexBufferBinds++);
+	}
+}
+
+void Renderer::pushDrawConstants(ignis::Pipeline& pipeline,
+								 const engine::PushConstants& pushConstants) {
+	// every pipeline is created with the same push constant range, so what
+	// was pushed under the previous pipeline stays valid after a rebind
+	uint32_t offset{0};
+	uint32_t size{sizeof(engine::PushConstants)};
+
+	if (m_elideState && m_bound.pushConstants) {
+		changedRange(*m_bound.pushConstants, pushConstants, offset, size);
+	}
 
-	Pipeline& pipeline = settings.material->getTemplate().getPipeline();
+	if (size > 0) {
+		getCommand().pushConstants(
+			pipeline, reinterpret_cast<const char*>(&pushConstants) + offset, size,
+			offset);
+	}
 
-	cmd.bindPipeline(pipeline);
+	m_bound.pushConstants = pushConstants;
 
-	cmd.setViewport(vp);
+	ETNA_STAT(m_stats.pushConstantBytes += size);
+}
 
-	cmd.setScissor(m_currTarget->getExtent().width,
-				   m_currTarget->getExtent().height);
+void Renderer::draw(const DrawSettings& settings) {
+	ETNA_TRACE_SCOPE("Renderer::draw");
 
-	cmd.bindIndexBuffer(*settings.mesh->getIndexBuffer());
+	assert(settings.mesh != nullptr && "Mesh is null");
+	assert(settings.instanceCount > 0 && "Instance count is zero");
+	assert(settings.material != nullptr);
 
-	const engine::PushConstants m_pushConstants{
+	const Material* material = settings.material.get();
+
+	// async pipelines that aren't ready yet are drawn with the fallback
+	if (!material->getTemplate().isReady()) {
+		material = engine::getFallbackMaterial().get();
+	}
+
+	Pipeline& pipeline = material->getTemplate().getPipeline();
+
+	bindState(pipeline, *settings.mesh, settings.viewport);
+
+	const engine::PushConstants pushConstants{
 		.model = settings.transform,
 		.vertices = settings.mesh->getVertexBuffer(),
-		.material = settings.material->getParamsUBO(),
+		.material = material->getParamsUBO(),
 		.instanceBuffer = settings.instanceBuffer,
 		.buff1 = settings.buff1,
 		.buff2 = settings.buff2,
 		.buff3 = settings.buff3,
+		.drawData = settings.drawData,
 	};
 
-	cmd.pushConstants(pipeline, m_pushConstants);
+	pushDrawConstants(pipeline, pushConstants);
+
+	getCommand().drawInstanced(settings.mesh->indexCount(), settings.instanceCount,
+							   0, 0, settings.firstInstance);
+
+	ETNA_STAT(m_stats.drawCalls++);
+	ETNA_STAT(m_stats.instances += settings.instanceCount);
+	ETNA_STAT(m_stats.triangles += uint64_t(settings.mesh->indexCount() / 3) *
+								   settings.instanceCount);
+}
+
+bool Renderer::supportsIndirect() {
+	return _device.isFeatureEnabled("MultiDrawIndirect") &&
+		   _device.isFeatureEnabled("DrawIndirectFirstInstance");
+}
+
+bool Renderer::supportsGpuCulling() {
+	return supportsIndirect() && _device.isFeatureEnabled("DrawIndirectCount");
+}
+
+void Renderer::cullIndirect(std::span<const VkDrawIndexedIndirectCommand> commands,
+							std::span<const BoundingSphere> bounds,
+							std::span<const CullRange> ranges,
+							const GpuCullView& view) {
+	ETNA_TRACE_SCOPE("Renderer::cullIndirect");
+
+	assert(m_culler != nullptr && "GPU culling is not enabled");
+
+	if (ranges.empty()) {
+		return;
+	}
+
+	Command& cmd = getCommand();
+
+	cmd.endRendering();
+
+	{
+		GpuScope scope(m_profiler, cmd, "cull");
+
+		m_culler->cull(cmd, *m_currTarget, commands, bounds, ranges, view);
+	}
+
+	RenderFrameSettings resume = m_frameSettings;
+	resume.colorLoadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	resume.depthLoadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	resume.colorStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
+	resume.depthStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
+
+	beginRendering(resume);
+
+	// the compute pass rebinds pipeline and push constants
+	m_bound = {};
+}
+
+void Renderer::drawIndirect(const IndirectDrawSettings& settings) {
+	ETNA_TRACE_SCOPE("Renderer::drawIndirect");
+
+	assert(settings.mesh != nullptr && settings.material != nullptr);
+	assert(settings.drawData != IGNIS_INVALID_BUFFER_ID);
+	assert(supportsIndirect());
+
+	if (settings.commands.empty()) {
+		return;
+	}
+
+	const MaterialTemplate& materialTemplate = settings.material->getTemplate();
+
+	assert(materialTemplate.isReady() && "Indirect draws need a ready pipeline");
+
+	Pipeline& pipeline = materialTemplate.getPipeline();
+
+	bindState(pipeline, *settings.mesh, settings.viewport);
+
+	// model, vertices and material all come from the draw records
+	const engine::PushConstants pushConstants{
+		.model = Mat4::identity(),
+		.vertices = IGNIS_INVALID_BUFFER_ID,
+		.material = engine::INVALID_UNIFORM,
+		.instanceBuffer = IGNIS_INVALID_BUFFER_ID,
+		.buff1 = settings.buff1,
+		.buff2 = settings.buff2,
+		.buff3 = settings.buff3,
+		.drawData = settings.drawData,
+	};
+
+	pushDrawConstants(pipeline, pushConstants);
+
+	ETNA_STAT(m_stats.drawCalls++);
+	ETNA_STAT(m_stats.indirectCommands += settings.commands.size());
+
+	if (settings.cullRange != IndirectDrawSettings::NO_CULL_RANGE) {
+		assert(m_culler != nullptr);
+
+		// how many survived is only known on the GPU, so the stats count
+		// every candidate
+		m_culler->drawCulled(getCommand(), settings.cullRange);
+
+		return;
+	}
+
+	const VkDeviceSize size =
+		settings.commands.size() * sizeof(VkDrawIndexedIndirectCommand);
+
+	const IndirectAllocation commands = allocateIndirect(size);
+
+	std::memcpy(commands.mapped, settings.commands.data(), size);
+
+	vkCmdDrawIndexedIndirect(getCommand().getHandle(), commands.buffer,
+							 commands.offset,
+							 static_cast<uint32_t>(settings.commands.size()),
+							 sizeof(VkDrawIndexedIndirectCommand));
+
+#ifdef ETNA_STATS
+	for (const VkDrawIndexedIndirectCommand& command : settings.commands) {
+		m_stats.instances += command.instanceCount;
+		m_stats.triangles +=
+			uint64_t(command.indexCount / 3) * command.instanceCount;
+	}
+#endif
+}
+
+RenderStats Renderer::getStats() const {
+	RenderStats stats = m_stats;
+
+	// device-wide counters, attributed to the frame they happened in
+	ETNA_STAT(const auto transfers = engine::getTransferCounters());
+	ETNA_STAT(stats.bufferUpdates =
+				  transfers.bufferUpdates - m_transferBase.bufferUpdates);
+	ETNA_STAT(stats.bufferUpdateBytes =
+				  transfers.bufferUpdateBytes - m_transferBase.bufferUpdateBytes);
+	ETNA_STAT(stats.immediateSubmits =
+				  transfers.immediateSubmits - m_transferBase.immediateSubmits);
+
+	return stats;
+}
 
-	cmd.drawInstanced(settings.mesh->indexCount(), settings.instanceCount);
+void Renderer::countCulled(uint32_t count) {
+	ETNA_STAT(m_stats.culledDraws += count);
 }
 
 void Renderer::clearViewport(Viewport vp, Color color) {
@@ -1,22 +1,33 @@
+#include <future>
+#include <limits>
 #include "etna/scene.hpp"
 #include "etna/default_materials.hpp"
 #include "etna/engine.hpp"
+#include "etna/trace.hpp"
 
 using namespace etna;
 using namespace ignis;
 
+namespace {
+
+// small enough to spread a few thousand rays over the workers
+constexpr size_t RAYS_PER_TASK{256};
+
+}  // namespace
+
 static MaterialHandle g_defaultMaterial{nullptr};
 
 Scene::Scene()
-	: m_sceneBuffer(_device.createUBO(sizeof(SceneData))),
-	  m_lightsBuffer(
-		  _device.createUBO(sizeof(ignis::BufferId) * Scene::MAX_LIGHTS)) {
+	: m_lightsBuffer(engine::allocateUniform(
+		  sizeof(engine::UniformHandle) * Scene::MAX_LIGHTS,
+		  nullptr,
+		  engine::MemoryCategory::OBJECT_UBO)) {
+
 	g_defaultMaterial = engine::createColorMaterial(WHITE);
 }
 
 Scene::~Scene() {
-	_device.destroyBuffer(m_sceneBuffer);
-	_device.destroyBuffer(m_lightsBuffer);
+	engine::freeUniform(m_lightsBuffer, engine::MemoryCategory::OBJECT_UBO);
 	g_defaultMaterial.reset();
 }
 
@@ -34,7 +45,7 @@ SceneNode Scene::addNode(SceneNode node,
 	if (node->getType() == _SceneNode::Type::LIGHT) {
 		m_lightCacheDirty = true;
 
-		std::vector<ignis::BufferId> lights;
+		std::vector<engine::UniformHandle> lights;
 
 		for (const auto& light : getLights()) {
 			if (light->light->getIntensity() > 0) {
@@ -47,12 +58,14 @@ SceneNode Scene::addNode(SceneNode node,
 		}
 
 		if (lights.size() > 0) {
-			_device.updateBuffer(m_lightsBuffer, lights.data());
+			engine::updateUniform(m_lightsBuffer, lights.data(),
+								  lights.size() * sizeof(engine::UniformHandle));
 		}
 	}
 
 	if (node->getType() == _SceneNode::Type::MESH) {
 		m_meshCacheDirty = true;
+		m_bvhDirty = true;
 	}
 
 	return node;
@@ -108,6 +121,9 @@ void Scene::removeNode(const std::string& name) {
 		return;
 	}
 
+	m_meshCacheDirty = true;
+	m_bvhDirty = true;
+
 	if (!node->isRoot()) {
 		return node->remove();
 	}
@@ -148,6 +164,10 @@ LightNode Scene::getLight(const std::string& name) const {
 void Scene::render(Renderer& renderer,
 				   const CameraNode& cameraNode,
 				   const SceneRenderInfo& info) {
+	ETNA_TRACE_SCOPE("Scene::render");
+
+	GpuScope scope(renderer.getProfiler(), renderer.getCommand(), "scene.render");
+
 	Viewport vp{info.viewport};
 
 	if (vp.width == 0) {
@@ -166,11 +186,41 @@ void Scene::render(Renderer& renderer,
 		.lightCount = static_cast<uint32_t>(getLights().size()),
 	};
 
-	_device.updateBuffer(m_sceneBuffer, &sceneData);
+	// also the camera's, wherever its node lives
+	updateTransforms();
 
 	cameraNode->camera->updateAspect(vp.width / vp.height);
 
-	for (const auto& meshNode : getMeshes()) {
+	const Camera::CameraData cameraData = cameraNode->camera->getData();
+
+	// the GPU may still be reading last frame's data, so per-frame uniforms
+	// live in the renderer's current frame slot
+	const engine::UniformHandle sceneBuffer =
+		renderer.allocateFrameUBO(sceneData);
+
+	const engine::UniformHandle cameraBuffer =
+		renderer.allocateFrameUBO(cameraData);
+
+	const Mat4 view = cameraNode->camera->getViewMatrix();
+
+	updateBvh();
+
+	m_visibleItems.clear();
+
+	if (info.frustumCulling) {
+		// the aspect was updated above, so this is the frustum of this viewport
+		m_bvh.queryFrustum(cameraNode->camera->getFrustum(), m_visibleItems);
+	} else {
+		for (uint32_t i{0}; i < m_bvh.itemCount(); i++) {
+			m_visibleItems.push_back(i);
+		}
+	}
+
+	m_renderQueue.clear();
+
+	for (uint32_t item : m_visibleItems) {
+		const _MeshNode* meshNode = m_bvh.getNode(item).get();
+
 		if (meshNode->mesh == nullptr)
 			continue;
 
@@ -180,17 +230,148 @@ void Scene::render(Renderer& renderer,
 		const MeshHandle mesh = meshNode->mesh;
 		const Mat4 worldMatrix = meshNode->getWorldMatrix();
 
-		renderer.draw({
+		// the camera looks down -z in view space
+		const float depth = -(view(2, 0) * worldMatrix(0, 3) +
+							  view(2, 1) * worldMatrix(1, 3) +
+							  view(2, 2) * worldMatrix(2, 3) + view(2, 3));
+
+		const DrawSettings draw{
 			.mesh = mesh,
 			.material = material,
 			.transform = worldMatrix,
 			.viewport = vp,
-			.buff1 = m_sceneBuffer,
-			.buff2 = cameraNode->camera->getDataBuffer(),
+			.buff1 = sceneBuffer,
+			.buff2 = cameraBuffer,
 			.instanceBuffer = meshNode->instanceBuffer,
 			.instanceCount = meshNode->instanceCount,
-		});
+		};
+
+		// the shader places instances, so their bounds are unknown here
+		const BoundingSphere sphere =
+			meshNode->instanceBuffer != IGNIS_INVALID_BUFFER_ID
+				? BoundingSphere{.radius = std::numeric_limits<float>::infinity()}
+				: mesh->getBoundingSphere().transform(worldMatrix);
+
+		m_renderQueue.push(draw, depth, sphere);
+	}
+
+	renderer.countCulled(m_bvh.itemCount() - m_renderQueue.size());
+
+	// the GPU tests what survived here again, adding occlusion
+	m_renderQueue.submit(renderer, {
+		.indirect = info.indirect && Renderer::supportsIndirect(),
+		.cullView = info.frustumCulling
+						? std::optional(GpuCullView{cameraData.viewproj, vp})
+						: std::nullopt,
+	});
+}
+
+std::vector<MeshNode> Scene::queryFrustum(const Frustum& frustum) const {
+	std::vector<uint32_t> items;
+
+	updateBvh();
+	m_bvh.queryFrustum(frustum, items);
+
+	return getBvhNodes(items);
+}
+
+std::vector<MeshNode> Scene::queryOverlap(const AABB& box) const {
+	std::vector<uint32_t> items;
+
+	updateBvh();
+	m_bvh.queryOverlap(box, items);
+
+	return getBvhNodes(items);
+}
+
+std::vector<MeshNode> Scene::queryOverlap(const BoundingSphere& sphere) const {
+	std::vector<uint32_t> items;
+
+	updateBvh();
+	m_bvh.queryOverlap(sphere, items);
+
+	return getBvhNodes(items);
+}
+
+std::vector<MeshNode> Scene::queryNearest(const Vec3& point, uint32_t k) const {
+	std::vector<uint32_t> items;
+
+	updateBvh();
+	m_bvh.queryNearest(point, k, items);
+
+	return getBvhNodes(items);
+}
+
+RaycastHit Scene::raycast(const Vec3& origin,
+						  const Vec3& direction,
+						  float maxDistance) const {
+	updateBvh();
+
+	Ray ray{.origin = origin, .direction = direction, .maxDistance = maxDistance};
+	ray.direction.normalize();
+
+	return m_bvh.raycast(ray);
+}
+
+void Scene::raycast(std::span<const Ray> rays, std::span<RaycastHit> hits) const {
+	ETNA_TRACE_SCOPE("Scene::raycast");
+
+	assert(hits.size() >= rays.size());
+
+	updateBvh();
+
+	const auto castRange = [this, rays, hits](size_t first, size_t last) {
+		for (size_t i{first}; i < last; i++) {
+			Ray ray = rays[i];
+			ray.direction.normalize();
+
+			hits[i] = m_bvh.raycast(ray);
+		}
+	};
+
+	std::vector<std::future<void>> tasks;
+
+	for (size_t first{RAYS_PER_TASK}; first < rays.size(); first += RAYS_PER_TASK) {
+		const size_t last = std::min(first + RAYS_PER_TASK, rays.size());
+
+		tasks.push_back(
+			engine::runAsync([castRange, first, last] { castRange(first, last); }));
+	}
+
+	// the calling thread takes the first chunk instead of waiting idle
+	castRange(0, std::min(RAYS_PER_TASK, rays.size()));
+
+	for (std::future<void>& task : tasks) {
+		task.get();
+	}
+}
+
+void Scene::updateTransforms() const {
+	ETNA_TRACE_SCOPE("Scene::updateTransforms");
+
+	scene::updateWorldMatrices();
+}
+
+void Scene::updateBvh() const {
+	updateTransforms();
+	if (m_bvhDirty) {
+		m_bvh.build(getMeshes());
+		m_bvhDirty = false;
+		return;
 	}
+
+	m_bvh.refit();
+}
+
+std::vector<MeshNode> Scene::getBvhNodes(const std::vector<uint32_t>& items) const {
+	std::vector<MeshNode> nodes;
+	nodes.reserve(items.size());
+
+	for (uint32_t item : items) {
+		nodes.push_back(m_bvh.getNode(item));
+	}
+
+	return nodes;
 }
 
 const std::unordered_map<std::string, SceneNode>& Scene::getNodes() const {
@@ -199,6 +380,8 @@ const std::unordered_map<std::string, SceneNode>& Scene::getNodes() const {
 
 // TEMP: add caching
 const std::vector<MeshNode>& Scene::getMeshes() const {
+	ETNA_TRACE_SCOPE("Scene::getMeshes");
+
 	if (!m_meshCacheDirty)
 		return m_meshCache;
 
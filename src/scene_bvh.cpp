@@ -0,0 +1,507 @@
+#include <algorithm>
+#include "etna/scene_bvh.hpp"
+#include "etna/trace.hpp"
+
+using namespace etna;
+
+namespace {
+
+// median splits keep the tree balanced, 2^64 items are far away
+constexpr uint32_t MAX_DEPTH{64};
+
+}  // namespace
+
+static AABB worldBounds(const _MeshNode& node) {
+	const Mat4 world = node.getWorldMatrix();
+
+	if (node.mesh == nullptr) {
+		const Vec3 origin{world(0, 3), world(1, 3), world(2, 3)};
+		return {.min = origin, .max = origin};
+	}
+
+	return node.mesh->getBounds().transform(world);
+}
+
+static uint32_t boundsVersion(const Mesh* mesh) {
+	return mesh != nullptr ? mesh->getBoundsVersion() : 0;
+}
+
+static Vec3 transformPoint(const Mat4& M, const Vec3& p) {
+	return {
+		M(0, 0) * p[0] + M(0, 1) * p[1] + M(0, 2) * p[2] + M(0, 3),
+		M(1, 0) * p[0] + M(1, 1) * p[1] + M(1, 2) * p[2] + M(1, 3),
+		M(2, 0) * p[0] + M(2, 1) * p[1] + M(2, 2) * p[2] + M(2, 3),
+	};
+}
+
+static Vec3 transformDirection(const Mat4& M, const Vec3& d) {
+	return {
+		M(0, 0) * d[0] + M(0, 1) * d[1] + M(0, 2) * d[2],
+		M(1, 0) * d[0] + M(1, 1) * d[1] + M(1, 2) * d[2],
+		M(2, 0) * d[0] + M(2, 1) * d[1] + M(2, 2) * d[2],
+	};
+}
+
+// world matrices are affine, so the inverse is the inverse of the 3x3 part
+// and its translation brought back through it; false if M is singular
+static bool invertAffine(const Mat4& M, Mat4& inverse) {
+	const float c00 = M(1, 1) * M(2, 2) - M(1, 2) * M(2, 1);
+	const float c01 = M(1, 2) * M(2, 0) - M(1, 0) * M(2, 2);
+	const float c02 = M(1, 0) * M(2, 1) - M(1, 1) * M(2, 0);
+
+	const float det = M(0, 0) * c00 + M(0, 1) * c01 + M(0, 2) * c02;
+
+	if (det == 0)
+		return false;
+
+	const float invDet = 1 / det;
+
+	inverse = Mat4::identity();
+
+	inverse(0, 0) = c00 * invDet;
+	inverse(0, 1) = (M(0, 2) * M(2, 1) - M(0, 1) * M(2, 2)) * invDet;
+	inverse(0, 2) = (M(0, 1) * M(1, 2) - M(0, 2) * M(1, 1)) * invDet;
+	inverse(1, 0) = c01 * invDet;
+	inverse(1, 1) = (M(0, 0) * M(2, 2) - M(0, 2) * M(2, 0)) * invDet;
+	inverse(1, 2) = (M(0, 2) * M(1, 0) - M(0, 0) * M(1, 2)) * invDet;
+	inverse(2, 0) = c02 * invDet;
+	inverse(2, 1) = (M(0, 1) * M(2, 0) - M(0, 0) * M(2, 1)) * invDet;
+	inverse(2, 2) = (M(0, 0) * M(1, 1) - M(0, 1) * M(1, 0)) * invDet;
+
+	const Vec3 translation =
+		transformDirection(inverse, {M(0, 3), M(1, 3), M(2, 3)});
+
+	for (uint32_t i{0}; i < 3; i++) {
+		inverse(i, 3) = -translation[i];
+	}
+
+	return true;
+}
+
+static bool touches(const Frustum& frustum, const AABB& box) {
+	return frustum.intersects(box);
+}
+
+static bool touches(const AABB& volume, const AABB& box) {
+	return volume.overlaps(box);
+}
+
+static bool touches(const BoundingSphere& sphere, const AABB& box) {
+	return sphere.overlaps(box);
+}
+
+SceneBvh::~SceneBvh() {
+	clear();
+}
+
+void SceneBvh::build(const std::vector<MeshNode>& meshes) {
+	ETNA_TRACE_SCOPE("SceneBvh::build");
+
+	clear();
+
+	m_boundsEpoch = Mesh::getBoundsEpoch();
+
+	m_items.reserve(meshes.size());
+
+	for (const MeshNode& node : meshes) {
+		if (node->instanceBuffer == IGNIS_INVALID_BUFFER_ID) {
+			m_items.push_back({
+				.node = node,
+				.bounds = worldBounds(*node),
+				.mesh = node->mesh.get(),
+				.meshVersion = boundsVersion(node->mesh.get()),
+			});
+		}
+	}
+
+	m_boundedCount = m_items.size();
+
+	for (const MeshNode& node : meshes) {
+		if (node->mesh != nullptr &&
+			node->instanceBuffer != IGNIS_INVALID_BUFFER_ID) {
+			m_items.push_back({.node = node});
+		}
+	}
+
+	if (m_boundedCount > 0) {
+		m_nodes.reserve(m_boundedCount);
+		m_nodes.push_back({.first = 0, .count = m_boundedCount, .parent = 0});
+
+		buildNode(0, 0);
+	}
+
+	for (uint32_t i{0}; i < m_items.size(); i++) {
+		m_items[i].node->m_bvhEntries.push_back({.bvh = this, .item = i});
+	}
+}
+
+// median split along the longest axis of the item centers
+void SceneBvh::buildNode(uint32_t index, uint32_t depth) {
+	const uint32_t first = m_nodes[index].first;
+	const uint32_t count = m_nodes[index].count;
+
+	AABB bounds = m_items[first].bounds;
+	AABB centers{.min = bounds.center(), .max = bounds.center()};
+
+	for (uint32_t i{first + 1}; i < first + count; i++) {
+		const Vec3 center = m_items[i].bounds.center();
+
+		bounds.merge(m_items[i].bounds);
+		centers.merge({.min = center, .max = center});
+	}
+
+	m_nodes[index].bounds = bounds;
+
+	if (count <= MAX_LEAF_ITEMS || depth + 1 == MAX_DEPTH) {
+		for (uint32_t i{first}; i < first + count; i++) {
+			m_items[i].leaf = index;
+		}
+
+		return;
+	}
+
+	const Vec3 size = centers.max - centers.min;
+
+	uint32_t axis{0};
+
+	if (size[1] > size[axis])
+		axis = 1;
+
+	if (size[2] > size[axis])
+		axis = 2;
+
+	const uint32_t half = count / 2;
+	const auto begin = m_items.begin() + first;
+
+	std::nth_element(begin, begin + half, begin + count,
+					 [axis](const Item& a, const Item& b) {
+						 return a.bounds.min[axis] + a.bounds.max[axis] <
+								b.bounds.min[axis] + b.bounds.max[axis];
+					 });
+
+	const uint32_t left = m_nodes.size();
+
+	m_nodes[index].left = left;
+
+	m_nodes.push_back({.first = first, .count = half, .parent = index});
+	m_nodes.push_back(
+		{.first = first + half, .count = count - half, .parent = index});
+
+	buildNode(left, depth + 1);
+	buildNode(left + 1, depth + 1);
+}
+
+void SceneBvh::refit() {
+	ETNA_TRACE_SCOPE("SceneBvh::refit");
+
+	const uint64_t epoch = Mesh::getBoundsEpoch();
+
+	if (epoch != m_boundsEpoch) {
+		m_boundsEpoch = epoch;
+
+		for (uint32_t i{0}; i < m_boundedCount; i++) {
+			const Mesh* mesh = m_items[i].node->mesh.get();
+
+			if (mesh != m_items[i].mesh ||
+				boundsVersion(mesh) != m_items[i].meshVersion)
+				markDirty(i);
+		}
+	}
+
+	for (uint32_t item : m_dirty) {
+		Item& entry = m_items[item];
+
+		entry.dirty = false;
+		entry.mesh = entry.node->mesh.get();
+		entry.meshVersion = boundsVersion(entry.mesh);
+		entry.bounds = worldBounds(*entry.node);
+
+		// stop as soon as an ancestor ends up with the box it had
+		uint32_t index = entry.leaf;
+
+		while (true) {
+			const Node& node = m_nodes[index];
+
+			AABB bounds;
+
+			if (node.left == 0) {
+				bounds = m_items[node.first].bounds;
+
+				for (uint32_t i{1}; i < node.count; i++) {
+					bounds.merge(m_items[node.first + i].bounds);
+				}
+			} else {
+				bounds = m_nodes[node.left].bounds;
+				bounds.merge(m_nodes[node.left + 1].bounds);
+			}
+
+			if (bounds.min == node.bounds.min && bounds.max == node.bounds.max)
+				break;
+
+			m_nodes[index].bounds = bounds;
+
+			if (index == 0)
+				break;
+
+			index = node.parent;
+		}
+	}
+
+	m_dirty.clear();
+}
+
+void SceneBvh::clear() {
+	// other scenes' entries on shared nodes stay
+	for (const Item& item : m_items) {
+		std::erase_if(item.node->m_bvhEntries,
+					  [this](const _MeshNode::BvhEntry& entry) {
+						  return entry.bvh == this;
+					  });
+	}
+
+	m_items.clear();
+	m_nodes.clear();
+	m_dirty.clear();
+	m_boundedCount = 0;
+}
+
+void SceneBvh::markDirty(uint32_t item) {
+	if (item >= m_boundedCount || m_items[item].dirty)
+		return;
+
+	m_items[item].dirty = true;
+	m_dirty.push_back(item);
+}
+
+template <typename Volume>
+void SceneBvh::queryVolume(const Volume& volume,
+						   std::vector<uint32_t>& items) const {
+	for (uint32_t i{m_boundedCount}; i < m_items.size(); i++) {
+		items.push_back(i);
+	}
+
+	if (m_nodes.empty())
+		return;
+
+	uint32_t stack[MAX_DEPTH + 1];
+	uint32_t size{0};
+
+	stack[size++] = 0;
+
+	while (size > 0) {
+		const Node& node = m_nodes[stack[--size]];
+
+		if (!touches(volume, node.bounds))
+			continue;
+
+		// the whole subtree is in, no need to look further down
+		if (volume.contains(node.bounds)) {
+			for (uint32_t i{node.first}; i < node.first + node.count; i++) {
+				items.push_back(i);
+			}
+
+			continue;
+		}
+
+		if (node.left != 0) {
+			stack[size++] = node.left + 1;
+			stack[size++] = node.left;
+			continue;
+		}
+
+		for (uint32_t i{node.first}; i < node.first + node.count; i++) {
+			if (touches(volume, m_items[i].bounds)) {
+				items.push_back(i);
+			}
+		}
+	}
+}
+
+void SceneBvh::queryFrustum(const Frustum& frustum,
+							std::vector<uint32_t>& items) const {
+	ETNA_TRACE_SCOPE("SceneBvh::queryFrustum");
+
+	queryVolume(frustum, items);
+}
+
+void SceneBvh::queryOverlap(const AABB& box, std::vector<uint32_t>& items) const {
+	queryVolume(box, items);
+}
+
+void SceneBvh::queryOverlap(const BoundingSphere& sphere,
+							std::vector<uint32_t>& items) const {
+	queryVolume(sphere, items);
+}
+
+// best first: nodes are opened closest box first, until the closest one left
+// is farther than the k-th item found
+void SceneBvh::queryNearest(const Vec3& point,
+							uint32_t k,
+							std::vector<uint32_t>& items) const {
+	if (k == 0 || m_nodes.empty())
+		return;
+
+	using Entry = std::pair<float, uint32_t>;
+
+	std::vector<Entry> open;
+	std::vector<Entry> found;
+
+	// a min heap of the open nodes and a max heap of the k best items
+	const auto farther = [](const Entry& a, const Entry& b) {
+		return a.first > b.first;
+	};
+
+	const auto closer = [](const Entry& a, const Entry& b) {
+		return a.first < b.first;
+	};
+
+	open.push_back({m_nodes[0].bounds.distance2(point), 0});
+
+	while (!open.empty()) {
+		std::pop_heap(open.begin(), open.end(), farther);
+
+		const auto [distance, index] = open.back();
+		open.pop_back();
+
+		if (found.size() == k && distance >= found.front().first)
+			break;
+
+		const Node& node = m_nodes[index];
+
+		if (node.left != 0) {
+			for (uint32_t child : {node.left, node.left + 1}) {
+				open.push_back({m_nodes[child].bounds.distance2(point), child});
+				std::push_heap(open.begin(), open.end(), farther);
+			}
+
+			continue;
+		}
+
+		for (uint32_t i{node.first}; i < node.first + node.count; i++) {
+			const float itemDistance = m_items[i].bounds.distance2(point);
+
+			if (found.size() == k) {
+				if (itemDistance >= found.front().first)
+					continue;
+
+				std::pop_heap(found.begin(), found.end(), closer);
+				found.pop_back();
+			}
+
+			found.push_back({itemDistance, i});
+			std::push_heap(found.begin(), found.end(), closer);
+		}
+	}
+
+	std::sort_heap(found.begin(), found.end(), closer);
+
+	for (const auto& [_, item] : found) {
+		items.push_back(item);
+	}
+}
+
+// items are tested in mesh space with the ray's parameter unchanged, which
+// an affine transform preserves, so mesh hits compare directly
+RaycastHit SceneBvh::raycast(const Ray& ray) const {
+	RaycastHit hit;
+
+	if (m_nodes.empty())
+		return hit;
+
+	const Vec3 invDirection{
+		1 / ray.direction[0],
+		1 / ray.direction[1],
+		1 / ray.direction[2],
+	};
+
+	constexpr float INF{std::numeric_limits<float>::infinity()};
+
+	float closest = ray.maxDistance;
+	uint32_t closestItem{~0u};
+	TriangleHit closestTriangle;
+
+	if (m_nodes[0].bounds.rayDistance(ray.origin, invDirection, closest) == INF)
+		return hit;
+
+	// far children and where the ray enters them, dropped once a hit is closer
+	uint32_t stack[MAX_DEPTH];
+	float stackDistance[MAX_DEPTH];
+	uint32_t size{0};
+	uint32_t index{0};
+
+	while (true) {
+		const Node& node = m_nodes[index];
+
+		if (node.left == 0) {
+			for (uint32_t i{node.first}; i < node.first + node.count; i++) {
+				const Item& item = m_items[i];
+
+				if (item.node->mesh == nullptr || !item.node->mesh->isRaycastable())
+					continue;
+
+				if (item.bounds.rayDistance(ray.origin, invDirection, closest) ==
+					INF)
+					continue;
+
+				Mat4 inverse;
+
+				if (!invertAffine(item.node->getWorldMatrix(), inverse))
+					continue;
+
+				const Ray local{
+					.origin = transformPoint(inverse, ray.origin),
+					.direction = transformDirection(inverse, ray.direction),
+					.maxDistance = closest,
+				};
+
+				if (item.node->mesh->getTriangleBvh().raycast(local,
+															  closestTriangle)) {
+					closest = closestTriangle.distance;
+					closestItem = i;
+				}
+			}
+		} else {
+			uint32_t near = node.left;
+			uint32_t far = node.left + 1;
+
+			float nearDistance =
+				m_nodes[near].bounds.rayDistance(ray.origin, invDirection, closest);
+			float farDistance =
+				m_nodes[far].bounds.rayDistance(ray.origin, invDirection, closest);
+
+			if (farDistance < nearDistance) {
+				std::swap(near, far);
+				std::swap(nearDistance, farDistance);
+			}
+
+			if (nearDistance != INF) {
+				if (farDistance != INF) {
+					stack[size] = far;
+					stackDistance[size++] = farDistance;
+				}
+
+				index = near;
+				continue;
+			}
+		}
+
+		while (size > 0 && stackDistance[size - 1] >= closest) {
+			size--;
+		}
+
+		if (size == 0)
+			break;
+
+		index = stack[--size];
+	}
+
+	if (closestItem == ~0u)
+		return hit;
+
+	return {
+		.node = m_items[closestItem].node,
+		.triangle = closestTriangle.triangle,
+		.barycentrics = {closestTriangle.u, closestTriangle.v},
+		.distance = closest,
+	};
+}
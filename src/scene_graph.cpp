@@ -1,23 +1,48 @@
 #include <algorithm>
 #include "etna/scene_graph.hpp"
 #include "etna/engine.hpp"
+#include "etna/scene_bvh.hpp"
+#include "transform_store.hpp"
 
 using namespace etna;
 
+// shared by every scene, as nodes are made outside any and may be added to
+// several; never destroyed, so nodes outliving static destruction can still
+// release their slots. Edits and updates stay on the thread that made the
+// first node.
+static TransformStore& transforms() {
+	static TransformStore* store = new TransformStore;
+	return *store;
+}
+
 _SceneNode::_SceneNode(Type type,
 					   const std::string& name,
 					   const Transform& transform)
-	: m_transform(transform),
-	  m_worldMatrix(transform.getWorldMatrix()),
+	: m_transformId(transforms().create(this, transform, type != Type::ROOT)),
 	  m_name(name),
 	  m_type(type) {}
 
+_SceneNode::~_SceneNode() {
+	// children kept alive elsewhere become roots; the rest are destroyed
+	// right after, so moving their subtrees would be wasted
+	for (const SceneNode& child : m_children) {
+		child->m_parent = nullptr;
+
+		if (child.use_count() > 1) {
+			transforms().setParent(child->m_transformId, TransformStore::NO_PARENT);
+		}
+	}
+
+	transforms().destroy(m_transformId);
+}
+
 SceneNode _SceneNode::add(SceneNode node) {
 	if (node == nullptr)
 		return nullptr;
 
 	SceneNode newNode = m_children.emplace_back(node);
 	newNode->m_parent = this;
+	transforms().setParent(newNode->m_transformId, m_transformId);
 	return newNode;
 }
 
@@ -45,60 +70,76 @@ void _SceneNode::remove() {
 
 	for (const auto& child : m_parent->m_children) {
 		if (child->m_name == m_name) {
+			// may be the last reference to the node
+			const SceneNode removed = child;
+
 			m_parent->m_children.erase(
 				std::remove(m_parent->m_children.begin(), m_parent->m_children.end(),
-							child),
+							removed),
 				m_parent->m_children.end());
 
+			removed->m_parent = nullptr;
+			transforms().setParent(removed->m_transformId,
+								   TransformStore::NO_PARENT);
+
 			break;
 		}
 	}
 }
 
-void _SceneNode::updateChildrenTransform(const Mat4& transform) {
+void _SceneNode::onWorldMatrixChanged() const {
 	if (m_type == Type::CAMERA) {
-		_CameraNode* cameraNode = static_cast<_CameraNode*>(this);
-		cameraNode->camera->updateTransform(transform);
+		const _CameraNode* cameraNode = static_cast<const _CameraNode*>(this);
+		cameraNode->camera->updateTransform(getWorldMatrix());
+	}
+
+	else if (m_type == Type::MESH) {
+		static_cast<const _MeshNode*>(this)->markBvhsDirty();
 	}
 
 	else if (m_type == Type::LIGHT) {
-		_LightNode* lightNode = static_cast<_LightNode*>(this);
+		const _LightNode* lightNode = static_cast<const _LightNode*>(this);
 		auto light = lightNode->light;
 
-		light->updateDirection(Transform::getRotMatrix3(transform) *
+		light->updateDirection(Transform::getRotMatrix3(getWorldMatrix()) *
 							   light->getDirection());
 	}
+}
 
-	for (auto child : m_children) {
-		child->m_worldMatrix = transform * child->m_transform.getWorldMatrix();
-		child->updateChildrenTransform(child->m_worldMatrix);
-	}
+Transform _SceneNode::getTransform() const {
+	return transforms().getLocal(m_transformId);
 }
 
-void _SceneNode::updateTransform(const Transform& transform) {
-	m_transform = transform;
-	m_worldMatrix = m_parent != nullptr
-						? m_parent->m_worldMatrix * transform.getWorldMatrix()
-						: transform.getWorldMatrix();
+Mat4 _SceneNode::getWorldMatrix() const {
+	return transforms().getWorld(m_transformId);
+}
 
-	updateChildrenTransform(m_worldMatrix);
+void _SceneNode::updateTransform(const Transform& transform) {
+	transforms().setLocal(m_transformId, transform);
 }
 
 void _SceneNode::updatePosition(const Vec3& position) {
-	m_transform.position = position;
-	updateTransform(m_transform);
+	Transform transform = getTransform();
+	transform.position = position;
+	updateTransform(transform);
 }
 
 void _SceneNode::translate(const Vec3& translation) {
-	m_transform.position += translation;
-	updateTransform(m_transform);
+	Transform transform = getTransform();
+	transform.position += translation;
+	updateTransform(transform);
 }
 
 void _SceneNode::rotate(float yaw, float pitch, float roll) {
-	m_transform.yaw += yaw;
-	m_transform.pitch += pitch;
-	m_transform.roll += roll;
-	updateTransform(m_transform);
+	Transform transform = getTransform();
+	transform.yaw += yaw;
+	transform.pitch += pitch;
+	transform.roll += roll;
+	updateTransform(transform);
+}
+
+void scene::updateWorldMatrices() {
+	transforms().update();
 }
 
 SceneNode scene::createRoot(const std::string& name, const Transform& transform) {
@@ -118,11 +159,26 @@ MeshNode scene::createMeshNode(const CreateMeshNodeInfo& info) {
 	node->instanceBuffer = info.instanceBuffer;
 	node->instanceCount = info.instanceCount;
 
+	engine::trackBuffer(node->instanceBuffer,
+						engine::MemoryCategory::INSTANCE_BUFFER);
+
 	return node;
 }
 
 _MeshNode::~_MeshNode() {
-	_device.destroyBuffer(instanceBuffer);
+	engine::retireBuffer(instanceBuffer, engine::MemoryCategory::INSTANCE_BUFFER);
+}
+
+void _MeshNode::setMesh(MeshHandle newMesh) {
+	mesh = std::move(newMesh);
+
+	markBvhsDirty();
+}
+
+void _MeshNode::markBvhsDirty() const {
+	for (const BvhEntry& entry : m_bvhEntries) {
+		entry.bvh->markDirty(entry.item);
+	}
 }
 
 CameraNode scene::createCameraNode(const CreateCameraNodeInfo& info) {
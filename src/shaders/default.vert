@@ -7,8 +7,12 @@ layout(location = 0) out vec2 outUV;
 layout(location = 1) out vec3 outNormal;
 
 void main() {
-    gl_Position = CAMERA.viewproj * pc.model * vec4(V.position, 1.0f);
+    mat4 model = MODEL;
+
+    gl_Position = CAMERA.viewproj * model * vec4(V.position, 1.0f);
 
     outUV = V.uv;
-    outNormal = transpose(inverse(mat3(pc.model))) * V.normal;
+    outNormal = transpose(inverse(mat3(model))) * V.normal;
+
+    FORWARD_DRAW_DATA();
 }
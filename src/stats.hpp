@@ -0,0 +1,9 @@
+#pragma once
+
+// counters behind ETNA_STATS cost nothing when the option is off: the
+// statement inside ETNA_STAT is not compiled at all
+#ifdef ETNA_STATS
+#define ETNA_STAT(statement) statement
+#else
+#define ETNA_STAT(statement)
+#endif
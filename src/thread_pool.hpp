@@ -0,0 +1,88 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+#include "etna/trace.hpp"
+
+namespace etna {
+
+// fixed set of workers draining a FIFO of tasks; the destructor finishes the
+// queued tasks before joining
+class ThreadPool {
+public:
+	ThreadPool(uint32_t threadCount) {
+		for (uint32_t i{0}; i < threadCount; i++) {
+			m_workers.emplace_back([this] { work(); });
+		}
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard lock(m_mutex);
+			m_stopping = true;
+		}
+
+		m_wake.notify_all();
+
+		for (std::thread& worker : m_workers) {
+			worker.join();
+		}
+	}
+
+	std::future<void> submit(std::function<void()> task) {
+		auto packaged =
+			std::make_shared<std::packaged_task<void()>>(std::move(task));
+		std::future<void> future = packaged->get_future();
+
+		{
+			std::lock_guard lock(m_mutex);
+			m_tasks.push([packaged] { (*packaged)(); });
+		}
+
+		m_wake.notify_one();
+
+		return future;
+	}
+
+private:
+	void work() {
+		ETNA_TRACE_THREAD("etna worker");
+
+		while (true) {
+			std::function<void()> task;
+
+			{
+				std::unique_lock lock(m_mutex);
+				m_wake.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+
+				if (m_tasks.empty()) {
+					return;
+				}
+
+				task = std::move(m_tasks.front());
+				m_tasks.pop();
+			}
+
+			task();
+		}
+	}
+
+	std::vector<std::thread> m_workers;
+	std::queue<std::function<void()>> m_tasks;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	bool m_stopping{false};
+
+public:
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool(ThreadPool&&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	ThreadPool& operator=(ThreadPool&&) = delete;
+};
+
+}  // namespace etna
@@ -0,0 +1,144 @@
+#ifdef ETNA_TRACING
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "etna/trace.hpp"
+#include "json.hpp"
+
+using namespace etna;
+
+namespace {
+
+constexpr uint64_t RING_SIZE{1 << 16};
+
+struct Event {
+	const char* name;
+	uint64_t start;
+	uint64_t end;
+};
+
+// written only by its thread; the head is published with release so a
+// reader sees every event below it
+struct ThreadRing {
+	std::array<Event, RING_SIZE> events;
+	std::atomic<uint64_t> head{0};
+	uint32_t tid;
+	std::string name;
+};
+
+std::mutex g_ringsMutex;
+std::vector<std::unique_ptr<ThreadRing>> g_rings;
+
+thread_local ThreadRing* t_ring{nullptr};
+
+}
+
+static ThreadRing& threadRing() {
+	if (t_ring != nullptr) {
+		return *t_ring;
+	}
+
+	std::lock_guard lock(g_ringsMutex);
+
+	auto& ring = g_rings.emplace_back(std::make_unique<ThreadRing>());
+	ring->tid = static_cast<uint32_t>(g_rings.size());
+	ring->name = "thread " + std::to_string(ring->tid);
+
+	t_ring = ring.get();
+
+	return *t_ring;
+}
+
+void trace::record(const char* name, uint64_t startNs, uint64_t endNs) {
+	ThreadRing& ring = threadRing();
+
+	const uint64_t head = ring.head.load(std::memory_order_relaxed);
+
+	ring.events[head % RING_SIZE] = {name, startNs, endNs};
+
+	ring.head.store(head + 1, std::memory_order_release);
+}
+
+void trace::setThreadName(const std::string& name) {
+	ThreadRing& ring = threadRing();
+
+	std::lock_guard lock(g_ringsMutex);
+	ring.name = name;
+}
+
+void trace::write(const std::string& path) {
+	std::ofstream file(path);
+
+	if (!file) {
+		throw std::runtime_error("failed to open " + path);
+	}
+
+	std::lock_guard lock(g_ringsMutex);
+
+	struct Snapshot {
+		const ThreadRing* ring;
+		std::vector<Event> events;
+	};
+
+	std::vector<Snapshot> snapshots;
+	uint64_t epoch{~0ull};
+
+	for (const auto& ring : g_rings) {
+		const uint64_t head = ring->head.load(std::memory_order_acquire);
+		const uint64_t first = head > RING_SIZE ? head - RING_SIZE : 0;
+
+		Snapshot snapshot{.ring = ring.get()};
+
+		for (uint64_t i{first}; i < head; i++) {
+			snapshot.events.push_back(ring->events[i % RING_SIZE]);
+		}
+
+		// the owner kept recording while we copied: drop the slots it may
+		// have overwritten
+		const uint64_t newHead = ring->head.load(std::memory_order_acquire);
+
+		if (newHead > first + RING_SIZE) {
+			const size_t stale = std::min<size_t>(newHead - RING_SIZE - first,
+												  snapshot.events.size());
+
+			snapshot.events.erase(snapshot.events.begin(),
+								  snapshot.events.begin() + stale);
+		}
+
+		for (const Event& event : snapshot.events) {
+			epoch = std::min(epoch, event.start);
+		}
+
+		snapshots.push_back(std::move(snapshot));
+	}
+
+	file << "{\"traceEvents\": [";
+
+	bool first{true};
+
+	for (const Snapshot& snapshot : snapshots) {
+		file << (first ? "\n" : ",\n")
+			 << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": "
+			 << snapshot.ring->tid << ", \"args\": {\"name\": \""
+			 << jsonEscape(snapshot.ring->name) << "\"}}";
+
+		first = false;
+
+		for (const Event& event : snapshot.events) {
+			file << ",\n{\"name\": \"" << jsonEscape(event.name)
+				 << "\", \"cat\": \"cpu\", \"ph\": \"X\", \"pid\": 0, \"tid\": "
+				 << snapshot.ring->tid
+				 << ", \"ts\": " << (event.start - epoch) / 1000.0
+				 << ", \"dur\": " << (event.end - event.start) / 1000.0 << "}";
+		}
+	}
+
+	file << "\n]}\n";
+}
+
+#endif
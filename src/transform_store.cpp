@@ -0,0 +1,533 @@
+#include <algorithm>
+#include <cassert>
+#include <future>
+#include "transform_store.hpp"
+#include "etna/engine.hpp"
+#include "etna/scene_graph.hpp"
+#include "etna/trace.hpp"
+
+using namespace etna;
+
+namespace {
+
+// dirty slots per task; fewer are resolved on the calling thread
+constexpr uint32_t CHUNK_SIZE{16384};
+
+// a level whose parents are at least 1/DENSE_PARENTS dirty is scanned whole,
+// cheaper by then than finding each child through its node
+constexpr uint32_t DENSE_PARENTS{16};
+
+}  // namespace
+
+TransformStore::Affine TransformStore::toAffine(const Mat4& matrix) {
+	Affine affine;
+
+	for (uint32_t r{0}; r < 3; r++) {
+		for (uint32_t c{0}; c < 4; c++) {
+			affine.rows[r][c] = matrix(r, c);
+		}
+	}
+
+	return affine;
+}
+
+TransformStore::TransformStore() : m_ownerThread(std::this_thread::get_id()) {}
+
+void TransformStore::assertOwnerThread() const {
+	assert(std::this_thread::get_id() == m_ownerThread &&
+		   "Scene graph edited off the thread that created it");
+}
+
+uint32_t TransformStore::create(_SceneNode* owner,
+								const Transform& transform,
+								bool listens) {
+	assertOwnerThread();
+
+	uint32_t id = m_slots.size();
+
+	if (!m_freeIds.empty()) {
+		id = m_freeIds.back();
+		m_freeIds.pop_back();
+	} else {
+		m_slots.push_back({});
+	}
+
+	const Affine local = toAffine(transform.getWorldMatrix());
+
+	append(0, NO_PARENT,
+		   {
+			   .id = id,
+			   .owner = owner,
+			   .local = transform,
+			   .localMatrix = local,
+			   .worldMatrix = local,
+			   .listens = listens,
+			   .edited = 0,
+		   });
+
+	return id;
+}
+
+// the node already detached its children
+void TransformStore::destroy(uint32_t id) {
+	assertOwnerThread();
+
+	removeAt(m_slots[id]);
+
+	// may stay in the edited list, update skips it while freed; a reused id
+	// listed twice is only cleared twice
+	m_slots[id].depth = FREED;
+	m_freeIds.push_back(id);
+}
+
+uint32_t TransformStore::append(uint32_t depth,
+								 uint32_t parent,
+								 const Moved& moved) {
+	if (depth == m_levels.size()) {
+		m_levels.emplace_back();
+	}
+
+	Level& level = m_levels[depth];
+
+	const uint32_t index = level.size();
+
+	level.ids.push_back(moved.id);
+	level.owners.push_back(moved.owner);
+	level.parents.push_back(parent);
+	level.locals.push_back(moved.local);
+	level.localMatrices.push_back(moved.localMatrix);
+	level.worldMatrices.push_back(moved.worldMatrix);
+	level.listens.push_back(moved.listens);
+	level.edited.push_back(moved.edited);
+	level.dirty.push_back(0);
+
+	m_slots[moved.id] = {.depth = depth, .index = index};
+
+	return index;
+}
+
+TransformStore::Moved TransformStore::removeAt(Slot slot) {
+	Level& level = m_levels[slot.depth];
+
+	const uint32_t i = slot.index;
+	const uint32_t last = level.size() - 1;
+
+	const Moved removed{
+		.id = level.ids[i],
+		.owner = level.owners[i],
+		.local = level.locals[i],
+		.localMatrix = level.localMatrices[i],
+		.worldMatrix = level.worldMatrices[i],
+		.listens = level.listens[i],
+		.edited = level.edited[i],
+	};
+
+	if (i != last) {
+		level.ids[i] = level.ids[last];
+		level.owners[i] = level.owners[last];
+		level.parents[i] = level.parents[last];
+		level.locals[i] = level.locals[last];
+		level.localMatrices[i] = level.localMatrices[last];
+		level.worldMatrices[i] = level.worldMatrices[last];
+		level.listens[i] = level.listens[last];
+		level.edited[i] = level.edited[last];
+
+		m_slots[level.ids[i]].index = i;
+
+		if (slot.depth + 1 < m_levels.size()) {
+			Level& below = m_levels[slot.depth + 1];
+
+			for (const SceneNode& child : level.owners[i]->getChildren()) {
+				const Slot childSlot = m_slots[child->m_transformId];
+
+				if (childSlot.depth == slot.depth + 1 &&
+					below.parents[childSlot.index] == last) {
+					below.parents[childSlot.index] = i;
+				}
+			}
+		}
+	}
+
+	level.ids.pop_back();
+	level.owners.pop_back();
+	level.parents.pop_back();
+	level.locals.pop_back();
+	level.localMatrices.pop_back();
+	level.worldMatrices.pop_back();
+	level.listens.pop_back();
+	level.edited.pop_back();
+	level.dirty.pop_back();
+
+	while (m_levels.size() > 1 && m_levels.back().size() == 0) {
+		m_levels.pop_back();
+	}
+
+	return removed;
+}
+
+void TransformStore::moveToDepth(uint32_t id, uint32_t depth, uint32_t parentId) {
+	const Slot old = m_slots[id];
+
+	if (old.depth == depth) {
+		m_levels[depth].parents[old.index] =
+			parentId == NO_PARENT ? NO_PARENT : m_slots[parentId].index;
+		return;
+	}
+
+	// found before any slot moves, while parent indices still tell them apart
+	std::vector<uint32_t> children;
+
+	if (old.depth + 1 < m_levels.size()) {
+		const Level& below = m_levels[old.depth + 1];
+
+		for (const SceneNode& child :
+			 m_levels[old.depth].owners[old.index]->getChildren()) {
+			const Slot childSlot = m_slots[child->m_transformId];
+
+			if (childSlot.depth == old.depth + 1 &&
+				below.parents[childSlot.index] == old.index) {
+				children.push_back(child->m_transformId);
+			}
+		}
+	}
+
+	const Moved moved = removeAt(old);
+
+	// the removal may have moved the parent within its level
+	append(depth, parentId == NO_PARENT ? NO_PARENT : m_slots[parentId].index,
+		   moved);
+
+	for (uint32_t child : children) {
+		moveToDepth(child, depth + 1, id);
+	}
+}
+
+void TransformStore::setParent(uint32_t id, uint32_t parentId) {
+	assertOwnerThread();
+
+	const uint32_t depth =
+		parentId == NO_PARENT ? 0 : m_slots[parentId].depth + 1;
+
+	moveToDepth(id, depth, parentId);
+
+	markEdited(id);
+}
+
+void TransformStore::setLocal(uint32_t id, const Transform& transform) {
+	assertOwnerThread();
+
+	const Slot slot = m_slots[id];
+
+	m_levels[slot.depth].locals[slot.index] = transform;
+
+	markEdited(id);
+}
+
+void TransformStore::markEdited(uint32_t id) {
+	const Slot slot = m_slots[id];
+	uint8_t& edited = m_levels[slot.depth].edited[slot.index];
+
+	if (edited)
+		return;
+
+	edited = 1;
+	m_editedIds.push_back(id);
+}
+
+Mat4 TransformStore::getCachedWorld(Slot slot) const {
+	const Affine& affine = m_levels[slot.depth].worldMatrices[slot.index];
+	Mat4 world = Mat4::identity();
+
+	for (uint32_t r{0}; r < 3; r++) {
+		for (uint32_t c{0}; c < 4; c++) {
+			world(r, c) = affine.rows[r][c];
+		}
+	}
+
+	return world;
+}
+
+// from the local transforms down from the topmost edited ancestor, whose
+// parent's cached matrix is still valid
+Mat4 TransformStore::getWorld(uint32_t id) const {
+	const Slot slot = m_slots[id];
+
+	if (m_editedIds.empty())
+		return getCachedWorld(slot);
+
+	const auto parentOf = [this](Slot s) -> Slot {
+		return {.depth = s.depth - 1, .index = m_levels[s.depth].parents[s.index]};
+	};
+
+	const auto edited = [this](Slot s) {
+		return m_levels[s.depth].edited[s.index] != 0;
+	};
+
+	bool found{false};
+	Slot topEdited{};
+
+	for (Slot s{slot};; s = parentOf(s)) {
+		if (edited(s)) {
+			topEdited = s;
+			found = true;
+		}
+
+		if (s.depth == 0)
+			break;
+	}
+
+	if (!found)
+		return getCachedWorld(slot);
+
+	Mat4 world = getLocal(id).getWorldMatrix();
+
+	for (Slot s{slot}; s.depth != topEdited.depth;) {
+		s = parentOf(s);
+		world = m_levels[s.depth].locals[s.index].getWorldMatrix() * world;
+	}
+
+	if (topEdited.depth > 0) {
+		world = getCachedWorld(parentOf(topEdited)) * world;
+	}
+
+	return world;
+}
+
+// The product works on whole rows, which the compiler turns into 4 wide
+// SIMD; the slots are scattered, but each one only reads its own row of the
+// level and its parent's.
+void TransformStore::resolveSlots(uint32_t depth, uint32_t first, uint32_t last) {
+	Level& level = m_levels[depth];
+
+	const uint32_t* resolved = level.resolved.data();
+	Affine* world = level.worldMatrices.data();
+	Affine* local = level.localMatrices.data();
+
+	const Affine* parentWorld =
+		depth == 0 ? nullptr : m_levels[depth - 1].worldMatrices.data();
+
+	for (uint32_t i{first}; i < last; i++) {
+		const uint32_t s = resolved[i];
+
+		if (level.edited[s]) {
+			local[s] = toAffine(level.locals[s].getWorldMatrix());
+		}
+
+		if (parentWorld == nullptr) {
+			world[s] = local[s];
+			continue;
+		}
+
+		const Affine& parent = parentWorld[level.parents[s]];
+		const Affine& child = local[s];
+
+		Affine result;
+
+		for (uint32_t r{0}; r < 3; r++) {
+			for (uint32_t c{0}; c < 4; c++) {
+				// the parent's translation only reaches the last column
+				result.rows[r][c] = parent.rows[r][0] * child.rows[0][c] +
+									parent.rows[r][1] * child.rows[1][c] +
+									parent.rows[r][2] * child.rows[2][c] +
+									(c == 3 ? parent.rows[r][3] : 0);
+			}
+		}
+
+		world[s] = result;
+	}
+}
+
+// The branch-free pass the dense levels take: every slot of the range reads
+// its parent's flag, and the dirty ones are packed at the front of the range.
+uint32_t TransformStore::resolveRange(uint32_t depth,
+									   uint32_t first,
+									   uint32_t last) {
+	Level& level = m_levels[depth];
+
+	const uint8_t* parentDirty = m_levels[depth - 1].dirty.data();
+	uint32_t* resolved = level.resolved.data();
+
+	uint32_t end{first};
+
+	for (uint32_t s{first}; s < last; s++) {
+		const uint8_t dirty = level.edited[s] | parentDirty[level.parents[s]];
+
+		level.dirty[s] = dirty;
+		resolved[end] = s;
+		end += dirty;
+	}
+
+	resolveSlots(depth, first, end);
+
+	return end - first;
+}
+
+// the sparse levels: a child is found through its node, so a level costs
+// only the dirty slots above it
+void TransformStore::gatherChildren(uint32_t firstChunk, uint32_t lastChunk) {
+	for (uint32_t c{firstChunk}; c < lastChunk; c++) {
+		const Chunk& chunk = m_chunks[c];
+		const Level& level = m_levels[chunk.depth];
+		Level& below = m_levels[chunk.depth + 1];
+
+		for (uint32_t i{chunk.first}; i < chunk.first + chunk.count; i++) {
+			const uint32_t parent = level.resolved[i];
+
+			for (const SceneNode& child : level.owners[parent]->getChildren()) {
+				const Slot slot = m_slots[child->m_transformId];
+
+				// a node added to another parent is still listed here
+				if (slot.depth != chunk.depth + 1 ||
+					below.parents[slot.index] != parent || below.dirty[slot.index]) {
+					continue;
+				}
+
+				below.dirty[slot.index] = 1;
+				below.resolved.push_back(slot.index);
+			}
+		}
+	}
+}
+
+void TransformStore::update() {
+	assertOwnerThread();
+
+	if (m_editedIds.empty())
+		return;
+
+	ETNA_TRACE_SCOPE("TransformStore::update");
+
+	m_chunks.clear();
+	m_editedSlots.resize(m_levels.size());
+
+	uint32_t minDepth{~0u};
+	uint32_t editedLeft{0};
+
+	for (uint32_t id : m_editedIds) {
+		const Slot slot = m_slots[id];
+
+		if (slot.depth == FREED)
+			continue;
+
+		minDepth = std::min(minDepth, slot.depth);
+		m_editedSlots[slot.depth].push_back(slot.index);
+		editedLeft++;
+	}
+
+	std::vector<std::future<void>> tasks;
+
+	uint32_t parentChunks{0};
+	uint32_t parentDirty{0};
+
+	// levels above the shallowest edit have nothing to resolve, levels past
+	// the last edit under no dirty parent neither
+	for (uint32_t d{minDepth}; d < m_levels.size(); d++) {
+		if (parentDirty == 0 && editedLeft == 0)
+			break;
+
+		Level& level = m_levels[d];
+		const uint32_t firstChunk = m_chunks.size();
+
+		std::vector<uint32_t>& edited = m_editedSlots[d];
+		editedLeft -= edited.size();
+
+		const bool dense =
+			d > minDepth && parentDirty * DENSE_PARENTS >= m_levels[d - 1].size();
+
+		if (dense) {
+			// the pass picks up the edited slots too
+			level.resolved.resize(level.size());
+
+			for (uint32_t first{0}; first < level.size(); first += CHUNK_SIZE) {
+				m_chunks.push_back({.depth = d, .first = first, .count = 0});
+			}
+		} else {
+			level.resolved.clear();
+
+			gatherChildren(parentChunks, firstChunk);
+
+			for (uint32_t s : edited) {
+				if (!level.dirty[s]) {
+					level.dirty[s] = 1;
+					level.resolved.push_back(s);
+				}
+			}
+
+			const uint32_t count = level.resolved.size();
+
+			for (uint32_t first{0}; first < count; first += CHUNK_SIZE) {
+				m_chunks.push_back({
+					.depth = d,
+					.first = first,
+					.count = std::min(CHUNK_SIZE, count - first),
+				});
+			}
+		}
+
+		edited.clear();
+
+		const auto resolveChunk = [this, dense, size = level.size()](Chunk& chunk) {
+			if (dense) {
+				const uint32_t last = std::min(chunk.first + CHUNK_SIZE, size);
+				chunk.count = resolveRange(chunk.depth, chunk.first, last);
+			} else {
+				resolveSlots(chunk.depth, chunk.first, chunk.first + chunk.count);
+			}
+		};
+
+		// the calling thread takes the first chunk, every level waits for the
+		// one above
+		for (uint32_t c{firstChunk + 1}; c < m_chunks.size(); c++) {
+			tasks.push_back(engine::runAsync(
+				[&resolveChunk, this, c] { resolveChunk(m_chunks[c]); }));
+		}
+
+		if (firstChunk < m_chunks.size()) {
+			resolveChunk(m_chunks[firstChunk]);
+		}
+
+		for (std::future<void>& task : tasks) {
+			task.get();
+		}
+
+		tasks.clear();
+
+		parentChunks = firstChunk;
+		parentDirty = 0;
+
+		for (uint32_t c{firstChunk}; c < m_chunks.size(); c++) {
+			parentDirty += m_chunks[c].count;
+		}
+	}
+
+	for (uint32_t id : m_editedIds) {
+		const Slot slot = m_slots[id];
+
+		if (slot.depth != FREED) {
+			m_levels[slot.depth].edited[slot.index] = 0;
+		}
+	}
+
+	m_editedIds.clear();
+
+	for (const Chunk& chunk : m_chunks) {
+		Level& level = m_levels[chunk.depth];
+
+		for (uint32_t i{chunk.first}; i < chunk.first + chunk.count; i++) {
+			level.dirty[level.resolved[i]] = 0;
+		}
+	}
+
+	// with the flags cleared, so the nodes read their new matrices
+	for (const Chunk& chunk : m_chunks) {
+		const Level& level = m_levels[chunk.depth];
+
+		for (uint32_t i{chunk.first}; i < chunk.first + chunk.count; i++) {
+			const uint32_t slot = level.resolved[i];
+
+			if (level.listens[slot]) {
+				level.owners[slot]->onWorldMatrixChanged();
+			}
+		}
+	}
+}
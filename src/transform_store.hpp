@@ -0,0 +1,151 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include "etna/transform.hpp"
+
+namespace etna {
+
+struct _SceneNode;
+
+// The transforms of every scene node, as flat arrays per depth level: the
+// local Transform, the local and world matrices, parent indices and dirty
+// flags. update resolves the hierarchy level by level, each level's parents
+// all done before it, visiting only the edited slots and their descendants.
+// A level under mostly dirty parents is scanned whole instead, and large
+// levels are split in chunks across the engine workers.
+//
+// Levels are kept as the graph changes: a new node is appended to level 0, a
+// destroyed one is swap-removed, and a reparented node moves with its subtree
+// to the levels of its new depth, so no edit costs more than the nodes it
+// moves. Nodes hold an id, stable across the moves; edits only mark the
+// slot. A world matrix is stale while the slot or an ancestor is marked, so
+// getWorld can recompute it along the parent chain without touching the
+// arrays until the next update.
+//
+// Not synchronized: create, destroy, the setters and update belong to the
+// thread that created the store, which debug builds assert. getWorld and
+// getLocal may run on several threads between updates.
+class TransformStore {
+public:
+	static constexpr uint32_t NO_PARENT{~0u};
+
+	TransformStore();
+
+	// nodes that don't listen are not told when their world matrix changes
+	uint32_t create(_SceneNode* owner, const Transform&, bool listens);
+
+	void destroy(uint32_t id);
+
+	void setParent(uint32_t id, uint32_t parentId);
+
+	void setLocal(uint32_t id, const Transform&);
+
+	const Transform& getLocal(uint32_t id) const {
+		const Slot slot = m_slots[id];
+		return m_levels[slot.depth].locals[slot.index];
+	}
+
+	// read only, so safe from several threads between updates
+	Mat4 getWorld(uint32_t id) const;
+
+	// resolves every marked slot and its descendants, then tells their
+	// nodes; nothing to do if no node was edited since the last call
+	void update();
+
+private:
+	// the top three rows, the last one is always 0 0 0 1
+	struct Affine {
+		alignas(16) float rows[3][4];
+	};
+
+	struct Slot {
+		uint32_t depth;
+		uint32_t index;
+	};
+
+	// the depth of a destroyed id's slot
+	static constexpr uint32_t FREED{~0u};
+
+	// the slots of one depth; parents index the level above
+	struct Level {
+		std::vector<uint32_t> ids;
+		std::vector<_SceneNode*> owners;
+		std::vector<uint32_t> parents;
+		std::vector<Transform> locals;
+		std::vector<Affine> localMatrices;
+		std::vector<Affine> worldMatrices;
+		std::vector<uint8_t> listens;
+		std::vector<uint8_t> edited;
+		std::vector<uint8_t> dirty;
+
+		// the dirty slots of the last update, by chunk; each is flagged in
+		// dirty while it runs
+		std::vector<uint32_t> resolved;
+
+		uint32_t size() const { return ids.size(); }
+	};
+
+	// a slot's data while it moves between levels
+	struct Moved {
+		uint32_t id;
+		_SceneNode* owner;
+		Transform local;
+		Affine localMatrix;
+		Affine worldMatrix;
+		uint8_t listens;
+		uint8_t edited;
+	};
+
+	static Affine toAffine(const Mat4&);
+
+	void assertOwnerThread() const;
+
+	uint32_t append(uint32_t depth, uint32_t parent, const Moved&);
+
+	// swap-removes the slot, repointing the children of the one moved into it
+	Moved removeAt(Slot);
+
+	// moves the node to the given depth below the parent, its subtree with it
+	void moveToDepth(uint32_t id, uint32_t depth, uint32_t parentId);
+
+	void markEdited(uint32_t id);
+
+	// recomputes the world matrices of [first, last) of the level's resolved
+	void resolveSlots(uint32_t depth, uint32_t first, uint32_t last);
+
+	// flags the slots of [first, last) under a dirty parent and resolves
+	// them, stored from first on in resolved; returns how many there were
+	uint32_t resolveRange(uint32_t depth, uint32_t first, uint32_t last);
+
+	// appends the children of the given chunks' slots to the next level's
+	// resolved
+	void gatherChildren(uint32_t firstChunk, uint32_t lastChunk);
+
+	Mat4 getCachedWorld(Slot) const;
+
+	// per id
+	std::vector<Slot> m_slots;
+	std::vector<uint32_t> m_freeIds;
+
+	std::vector<Level> m_levels;
+
+	std::vector<uint32_t> m_editedIds;
+
+	// the edited slot indices by depth, while an update runs
+	std::vector<std::vector<uint32_t>> m_editedSlots;
+
+	// the slots an update resolved: [first, first + count) of the level's
+	// resolved
+	struct Chunk {
+		uint32_t depth;
+		uint32_t first;
+		uint32_t count;
+	};
+
+	std::vector<Chunk> m_chunks;
+
+	std::thread::id m_ownerThread;
+};
+
+}  // namespace etna
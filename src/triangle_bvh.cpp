@@ -0,0 +1,311 @@
+#include "etna/triangle_bvh.hpp"
+#include "etna/trace.hpp"
+
+using namespace etna;
+
+namespace {
+
+constexpr uint32_t MAX_DEPTH{64};
+constexpr uint32_t SAH_BINS{16};
+
+// below this a node is never split, above the other it always is
+constexpr uint32_t MIN_LEAF_TRIANGLES{2};
+constexpr uint32_t MAX_LEAF_TRIANGLES{8};
+
+constexpr float INF{std::numeric_limits<float>::infinity()};
+
+}  // namespace
+
+static float dot(const Vec3& a, const Vec3& b) {
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+TriangleBvh::TriangleBvh(std::span<const Vec3> positions,
+						 std::span<const uint32_t> indices) {
+	ETNA_TRACE_SCOPE("TriangleBvh::build");
+
+	const uint32_t count = indices.size() / 3;
+
+	if (count == 0)
+		return;
+
+	std::vector<BuildTriangle> triangles(count);
+
+	for (uint32_t i{0}; i < count; i++) {
+		const Vec3& a = positions[indices[i * 3 + 0]];
+		const Vec3& b = positions[indices[i * 3 + 1]];
+		const Vec3& c = positions[indices[i * 3 + 2]];
+
+		AABB bounds{.min = a, .max = a};
+		bounds.merge({.min = b, .max = b});
+		bounds.merge({.min = c, .max = c});
+
+		triangles[i] = {.bounds = bounds, .center = bounds.center(), .id = i};
+	}
+
+	// a binary tree with a triangle per leaf at worst
+	m_nodes.reserve(count * 2 - 1);
+	m_nodes.push_back({.first = 0, .count = count});
+
+	buildNode(0, triangles, 0);
+
+	m_triangles.reserve(count);
+	m_ids.reserve(count);
+
+	for (const BuildTriangle& triangle : triangles) {
+		const uint32_t id = triangle.id;
+
+		const Vec3& a = positions[indices[id * 3 + 0]];
+		const Vec3& b = positions[indices[id * 3 + 1]];
+		const Vec3& c = positions[indices[id * 3 + 2]];
+
+		m_triangles.push_back({.v0 = a, .e1 = b - a, .e2 = c - a});
+		m_ids.push_back(id);
+	}
+}
+
+// splits where the surface area heuristic is lowest, evaluated at the
+// boundaries of SAH_BINS bins along each axis of the triangle centers
+void TriangleBvh::buildNode(uint32_t index,
+							std::vector<BuildTriangle>& triangles,
+							uint32_t depth) {
+	const uint32_t first = m_nodes[index].first;
+	const uint32_t count = m_nodes[index].count;
+
+	AABB bounds = triangles[first].bounds;
+	AABB centers{.min = triangles[first].center, .max = triangles[first].center};
+
+	for (uint32_t i{first + 1}; i < first + count; i++) {
+		bounds.merge(triangles[i].bounds);
+		centers.merge({.min = triangles[i].center, .max = triangles[i].center});
+	}
+
+	m_nodes[index].bounds = bounds;
+
+	if (count <= MIN_LEAF_TRIANGLES || depth + 1 == MAX_DEPTH)
+		return;
+
+	struct Bin {
+		AABB bounds;
+		uint32_t count{0};
+	};
+
+	float bestCost{INF};
+	uint32_t bestAxis{0};
+	uint32_t bestSplit{0};
+
+	for (uint32_t axis{0}; axis < 3; axis++) {
+		const float low = centers.min[axis];
+		const float extent = centers.max[axis] - low;
+
+		if (extent <= 0)
+			continue;
+
+		const float scale = SAH_BINS / extent;
+
+		Bin bins[SAH_BINS];
+
+		for (uint32_t i{first}; i < first + count; i++) {
+			const uint32_t bin = std::min(
+				SAH_BINS - 1, uint32_t((triangles[i].center[axis] - low) * scale));
+
+			if (bins[bin].count++ == 0) {
+				bins[bin].bounds = triangles[i].bounds;
+			} else {
+				bins[bin].bounds.merge(triangles[i].bounds);
+			}
+		}
+
+		// cost of splitting before bin i, from both sides
+		float leftCost[SAH_BINS]{};
+		AABB box;
+		uint32_t boxCount{0};
+
+		for (uint32_t i{0}; i + 1 < SAH_BINS; i++) {
+			if (bins[i].count > 0) {
+				if (boxCount == 0) {
+					box = bins[i].bounds;
+				} else {
+					box.merge(bins[i].bounds);
+				}
+
+				boxCount += bins[i].count;
+			}
+
+			leftCost[i + 1] = boxCount * (boxCount > 0 ? box.surfaceArea() : 0);
+		}
+
+		boxCount = 0;
+
+		for (uint32_t i{SAH_BINS - 1}; i > 0; i--) {
+			if (bins[i].count > 0) {
+				if (boxCount == 0) {
+					box = bins[i].bounds;
+				} else {
+					box.merge(bins[i].bounds);
+				}
+
+				boxCount += bins[i].count;
+			}
+
+			if (boxCount == 0 || boxCount == count)
+				continue;
+
+			const float cost = leftCost[i] + boxCount * box.surfaceArea();
+
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = i;
+			}
+		}
+	}
+
+	// small nodes stay leaves unless a split beats testing all their triangles
+	if (bestCost >= count * bounds.surfaceArea() && count <= MAX_LEAF_TRIANGLES)
+		return;
+
+	const auto begin = triangles.begin() + first;
+	auto middle = begin + count / 2;
+
+	if (bestCost < INF) {
+		const float low = centers.min[bestAxis];
+		const float scale = SAH_BINS / (centers.max[bestAxis] - low);
+
+		middle = std::partition(
+			begin, begin + count, [=](const BuildTriangle& triangle) {
+				const uint32_t bin = std::min(
+					SAH_BINS - 1,
+					uint32_t((triangle.center[bestAxis] - low) * scale));
+
+				return bin < bestSplit;
+			});
+	}
+
+	// all centers in one spot, any split is as good
+	if (middle == begin || middle == begin + count) {
+		middle = begin + count / 2;
+	}
+
+	const uint32_t leftCount = middle - begin;
+	const uint32_t left = m_nodes.size();
+
+	m_nodes[index].first = left;
+	m_nodes[index].count = 0;
+
+	m_nodes.push_back({.first = first, .count = leftCount});
+	m_nodes.push_back({.first = first + leftCount, .count = count - leftCount});
+
+	buildNode(left, triangles, depth + 1);
+	buildNode(left + 1, triangles, depth + 1);
+}
+
+// near child first, so the closest hit shrinks the ray early and the far
+// child is often skipped
+bool TriangleBvh::raycast(const Ray& ray, TriangleHit& hit) const {
+	if (m_nodes.empty())
+		return false;
+
+	const Vec3 invDirection{
+		1 / ray.direction[0],
+		1 / ray.direction[1],
+		1 / ray.direction[2],
+	};
+
+	float closest = ray.maxDistance;
+	uint32_t closestTriangle{~0u};
+	float closestU{0};
+	float closestV{0};
+
+	if (m_nodes[0].bounds.rayDistance(ray.origin, invDirection, closest) == INF)
+		return false;
+
+	// far children and where the ray enters them, dropped once a hit is closer
+	uint32_t stack[MAX_DEPTH];
+	float stackDistance[MAX_DEPTH];
+	uint32_t size{0};
+	uint32_t index{0};
+
+	while (true) {
+		const Node& node = m_nodes[index];
+
+		if (node.count > 0) {
+			// two sided Moller-Trumbore
+			for (uint32_t i{node.first}; i < node.first + node.count; i++) {
+				const Triangle& triangle = m_triangles[i];
+
+				const Vec3 p = ray.direction.cross(triangle.e2);
+				const float det = dot(triangle.e1, p);
+
+				if (std::abs(det) < 1e-12f)
+					continue;
+
+				const float invDet = 1 / det;
+				const Vec3 s = ray.origin - triangle.v0;
+				const float u = dot(s, p) * invDet;
+
+				if (u < 0 || u > 1)
+					continue;
+
+				const Vec3 q = s.cross(triangle.e1);
+				const float v = dot(ray.direction, q) * invDet;
+
+				if (v < 0 || u + v > 1)
+					continue;
+
+				const float t = dot(triangle.e2, q) * invDet;
+
+				if (t > 0 && t < closest) {
+					closest = t;
+					closestTriangle = i;
+					closestU = u;
+					closestV = v;
+				}
+			}
+		} else {
+			uint32_t near = node.first;
+			uint32_t far = node.first + 1;
+
+			float nearDistance =
+				m_nodes[near].bounds.rayDistance(ray.origin, invDirection, closest);
+			float farDistance =
+				m_nodes[far].bounds.rayDistance(ray.origin, invDirection, closest);
+
+			if (farDistance < nearDistance) {
+				std::swap(near, far);
+				std::swap(nearDistance, farDistance);
+			}
+
+			if (nearDistance != INF) {
+				if (farDistance != INF) {
+					stack[size] = far;
+					stackDistance[size++] = farDistance;
+				}
+
+				index = near;
+				continue;
+			}
+		}
+
+		while (size > 0 && stackDistance[size - 1] >= closest) {
+			size--;
+		}
+
+		if (size == 0)
+			break;
+
+		index = stack[--size];
+	}
+
+	if (closestTriangle == ~0u)
+		return false;
+
+	hit = {
+		.triangle = m_ids[closestTriangle],
+		.distance = closest,
+		.u = closestU,
+		.v = closestV,
+	};
+
+	return true;
+}
@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <unordered_map>
+#include "etna/engine.hpp"
+
+using namespace etna;
+
+namespace {
+
+constexpr uint32_t MAX_SLOTS{1u << engine::UNIFORM_SLOT_BITS};
+constexpr uint32_t SLOT_MASK{MAX_SLOTS - 1};
+
+// every block of a page has the same stride, so shaders can index the page
+// as an array of their struct
+struct Page {
+	VkDeviceSize stride;
+	uint32_t capacity;
+	std::vector<uint32_t> freeSlots;
+};
+
+std::unordered_map<ignis::BufferId, Page> g_pages;
+
+// per stride, the pages that still have free slots
+std::unordered_map<VkDeviceSize, std::vector<ignis::BufferId>> g_available;
+
+}
+
+static VkDeviceSize strideOf(size_t size) {
+	return (static_cast<VkDeviceSize>(size) + 15) & ~VkDeviceSize(15);
+}
+
+static void destroyPages() {
+	for (const auto& [buffer, _] : g_pages) {
+		_device.destroyBuffer(buffer);
+	}
+
+	g_pages.clear();
+	g_available.clear();
+}
+
+static ignis::BufferId createPage(VkDeviceSize stride) {
+	if (g_pages.empty()) {
+		engine::queueForDeletion(destroyPages);
+	}
+
+	const uint32_t capacity = static_cast<uint32_t>(std::clamp<VkDeviceSize>(
+		engine::UNIFORM_PAGE_SIZE / stride, 1, MAX_SLOTS));
+
+	const ignis::BufferId buffer = _device.createSSBO(stride * capacity);
+
+	assert((buffer >> (32 - engine::UNIFORM_SLOT_BITS)) == 0 &&
+		   "Buffer id does not fit in a uniform handle");
+
+	Page& page = g_pages[buffer];
+	page.stride = stride;
+	page.capacity = capacity;
+
+	// popped from the back, so slots are handed out in order
+	for (uint32_t slot{capacity}; slot > 0; slot--) {
+		page.freeSlots.push_back(slot - 1);
+	}
+
+	return buffer;
+}
+
+engine::UniformHandle engine::allocateUniform(size_t size,
+											  const void* data,
+											  MemoryCategory category) {
+	assert(size > 0);
+
+	const VkDeviceSize stride = strideOf(size);
+
+	std::vector<ignis::BufferId>& available = g_available[stride];
+
+	if (available.empty()) {
+		available.push_back(createPage(stride));
+	}
+
+	const ignis::BufferId buffer = available.back();
+	Page& page = g_pages[buffer];
+
+	const uint32_t slot = page.freeSlots.back();
+	page.freeSlots.pop_back();
+
+	if (page.freeSlots.empty()) {
+		available.pop_back();
+	}
+
+	if (data != nullptr) {
+		updateBuffer(buffer, data, slot * stride, size);
+	}
+
+	trackMemory(category, stride);
+
+	return (buffer << UNIFORM_SLOT_BITS) | slot;
+}
+
+void engine::updateUniform(UniformHandle handle, const void* data, size_t size) {
+	const ignis::BufferId buffer = handle >> UNIFORM_SLOT_BITS;
+
+	auto it = g_pages.find(buffer);
+	assert(it != g_pages.end() && size <= it->second.stride);
+
+	// a copy on the queue rather than a write in place: frames in flight may
+	// still read the block, the staging batch waits for them and runs before
+	// the next one
+	immediateUpdate(buffer, data, (handle & SLOT_MASK) * it->second.stride, size);
+}
+
+void engine::freeUniform(UniformHandle handle, MemoryCategory category) {
+	if (handle == INVALID_UNIFORM) {
+		return;
+	}
+
+	queueForRetirement([=] {
+		auto it = g_pages.find(handle >> UNIFORM_SLOT_BITS);
+
+		// the pages are already gone at shutdown
+		if (it == g_pages.end()) {
+			return;
+		}
+
+		Page& page = it->second;
+
+		if (page.freeSlots.empty()) {
+			g_available[page.stride].push_back(it->first);
+		}
+
+		page.freeSlots.push_back(handle & SLOT_MASK);
+
+		trackMemory(category, -int64_t(page.stride));
+	});
+}
+
+engine::UniformArenaStats engine::getUniformArenaStats() {
+	UniformArenaStats stats{};
+
+	for (const auto& [_, page] : g_pages) {
+		stats.pages++;
+		stats.blocks += page.capacity - page.freeSlots.size();
+		stats.pageBytes += page.stride * page.capacity;
+	}
+
+	return stats;
+}
@@ -0,0 +1,279 @@
+#include <deque>
+#include "ignis/command.hpp"
+#include "ignis/fence.hpp"
+#include "etna/engine.hpp"
+#include "stats.hpp"
+
+using namespace etna;
+using namespace ignis;
+
+namespace {
+
+constexpr VkDeviceSize STAGING_ALIGNMENT{16};
+
+struct UploadBatch {
+	Command* cmd;
+	Fence* fence;
+	engine::CompletionToken token{0};
+	VkDeviceSize ringBytes{0};
+	std::vector<Buffer*> dedicated;
+};
+
+Buffer* g_stagingRing{nullptr};
+VkDeviceSize g_ringHead{0};
+VkDeviceSize g_ringUsed{0};
+
+UploadBatch* g_recording{nullptr};
+std::deque<UploadBatch*> g_inFlight;
+std::vector<UploadBatch*> g_freeBatches;
+
+}
+
+static void retireBatch(UploadBatch* batch);
+
+static void destroyUploads() {
+	while (!g_inFlight.empty()) {
+		UploadBatch* batch = g_inFlight.front();
+		g_inFlight.pop_front();
+		retireBatch(batch);
+	}
+
+	if (g_recording != nullptr) {
+		retireBatch(g_recording);
+		g_recording = nullptr;
+	}
+
+	for (UploadBatch* batch : g_freeBatches) {
+		delete batch->cmd;
+		delete batch->fence;
+		delete batch;
+	}
+
+	g_freeBatches.clear();
+
+	engine::trackMemory(engine::MemoryCategory::STAGING,
+						-int64_t(engine::STAGING_RING_SIZE));
+
+	delete g_stagingRing;
+	g_stagingRing = nullptr;
+}
+
+static void initUploads() {
+	if (g_stagingRing != nullptr) {
+		return;
+	}
+
+	g_stagingRing =
+		new Buffer(_device.createStagingBuffer(engine::STAGING_RING_SIZE));
+
+	engine::trackMemory(engine::MemoryCategory::STAGING, engine::STAGING_RING_SIZE);
+
+	engine::queueForDeletion(destroyUploads);
+}
+
+static void retireBatch(UploadBatch* batch) {
+	g_ringUsed -= batch->ringBytes;
+
+	for (Buffer* buffer : batch->dedicated) {
+		engine::trackMemory(engine::MemoryCategory::STAGING,
+							-int64_t(buffer->getSize()));
+		delete buffer;
+	}
+
+	batch->dedicated.clear();
+	batch->ringBytes = 0;
+	batch->fence->reset();
+
+	engine::signalToken(batch->token);
+
+	g_freeBatches.push_back(batch);
+}
+
+// retires every submitted batch whose fence has signaled, without blocking
+static void pollUploads() {
+	while (!g_inFlight.empty()) {
+		UploadBatch* batch = g_inFlight.front();
+
+		if (vkGetFenceStatus(_device.getDevice(), batch->fence->getHandle()) !=
+			VK_SUCCESS) {
+			return;
+		}
+
+		g_inFlight.pop_front();
+		retireBatch(batch);
+	}
+}
+
+static void waitOldestUpload() {
+	UploadBatch* batch = g_inFlight.front();
+	g_inFlight.pop_front();
+
+	engine::waitFence(*batch->fence);
+	retireBatch(batch);
+}
+
+static UploadBatch& recordingBatch() {
+	if (g_recording != nullptr) {
+		return *g_recording;
+	}
+
+	if (g_freeBatches.empty()) {
+		g_freeBatches.push_back(new UploadBatch{
+			.cmd = engine::newUploadCommand(),
+			.fence = new Fence(_device.createFence()),
+		});
+	}
+
+	g_recording = g_freeBatches.back();
+	g_freeBatches.pop_back();
+
+	g_recording->token = engine::nextToken();
+	g_recording->cmd->begin();
+
+	// previously submitted work may still read the buffers we overwrite
+	const VkMemoryBarrier barrier{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+	};
+
+	vkCmdPipelineBarrier(g_recording->cmd->getHandle(),
+						 VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+						 VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr,
+						 0, nullptr);
+
+	return *g_recording;
+}
+
+// reserves size bytes of the ring, blocking on the oldest uploads if full
+static bool reserveRing(VkDeviceSize size, VkDeviceSize& offset) {
+	size = (size + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+
+	if (size > engine::STAGING_RING_SIZE) {
+		return false;
+	}
+
+	VkDeviceSize wasted{0};
+
+	while (true) {
+		if (g_ringUsed == 0) {
+			g_ringHead = 0;
+		}
+
+		wasted = g_ringHead + size > engine::STAGING_RING_SIZE
+					 ? engine::STAGING_RING_SIZE - g_ringHead
+					 : 0;
+
+		if (g_ringUsed + wasted + size <= engine::STAGING_RING_SIZE) {
+			break;
+		}
+
+		if (g_inFlight.empty()) {
+			engine::flushUploads();
+		}
+
+		waitOldestUpload();
+	}
+
+	offset = wasted ? 0 : g_ringHead;
+	g_ringHead = offset + size;
+	g_ringUsed += wasted + size;
+
+	recordingBatch().ringBytes += wasted + size;
+
+	return true;
+}
+
+engine::CompletionToken engine::upload(BufferId buffer,
+									   const void* data,
+									   VkDeviceSize offset,
+									   VkDeviceSize size) {
+	return upload(_device.getBuffer(buffer), data, offset, size);
+}
+
+engine::CompletionToken engine::upload(const Buffer& buffer,
+									   const void* data,
+									   VkDeviceSize offset,
+									   VkDeviceSize size) {
+	initUploads();
+	pollUploads();
+
+	if (size == 0) {
+		size = buffer.getSize() - offset;
+	}
+
+	// uniform, camera, light and mesh updates all come through here
+	ETNA_STAT(engine::countBufferUpdate(size));
+
+	VkDeviceSize stagingOffset{0};
+
+	if (reserveRing(size, stagingOffset)) {
+		g_stagingRing->writeData(data, stagingOffset, size);
+
+		UploadBatch& batch = recordingBatch();
+		batch.cmd->copyBuffer(*g_stagingRing, buffer, stagingOffset, offset, size);
+
+		return batch.token;
+	}
+
+	// too big for the ring: give it its own staging buffer for this batch
+	UploadBatch& batch = recordingBatch();
+
+	Buffer* staging = new Buffer(_device.createStagingBuffer(size, data));
+	batch.dedicated.push_back(staging);
+
+	engine::trackMemory(engine::MemoryCategory::STAGING, size);
+	batch.cmd->copyBuffer(*staging, buffer, 0, offset, size);
+
+	return batch.token;
+}
+
+engine::CompletionToken engine::flushUploads() {
+	if (g_recording == nullptr) {
+		return 0;
+	}
+
+	UploadBatch* batch = g_recording;
+	g_recording = nullptr;
+
+	// make the copies visible to anything submitted after this batch
+	const VkMemoryBarrier barrier{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT,
+	};
+
+	vkCmdPipelineBarrier(batch->cmd->getHandle(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0,
+						 nullptr, 0, nullptr);
+
+	batch->cmd->end();
+
+	_device.submitCommands({{.command = *batch->cmd}}, batch->fence);
+
+	g_inFlight.push_back(batch);
+
+	return batch->token;
+}
+
+bool engine::isComplete(CompletionToken token) {
+	pollUploads();
+
+	return token <= getCompletedToken();
+}
+
+void engine::waitFor(CompletionToken token) {
+	if (g_recording != nullptr && token >= g_recording->token) {
+		flushUploads();
+	}
+
+	while (token > getCompletedToken() && !g_inFlight.empty()) {
+		waitOldestUpload();
+	}
+
+	// not an upload: only frame fences can tell, fall back to an idle wait
+	if (token > getCompletedToken()) {
+		_device.waitIdle();
+		signalToken(token);
+	}
+}
@@ -4,6 +4,7 @@
 #include "ignis/semaphore.hpp"
 #include "etna/window.hpp"
 #include "etna/engine.hpp"
+#include "etna/trace.hpp"
 
 using namespace etna;
 using namespace ignis;
@@ -11,6 +12,10 @@ using namespace ignis;
 Window::Window(const CreateInfo& info)
 	: RenderTarget(RenderTarget::CreateInfo{.extent = {info.width, info.height}}),
 	  m_creationInfo(info) {
+	if (engine::isHeadless()) {
+		throw std::runtime_error("failed to create window: the engine is headless");
+	}
+
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
@@ -29,11 +34,16 @@ Window::Window(const CreateInfo& info)
 		.presentMode = VK_PRESENT_MODE_MAILBOX_KHR,
 	}));
 
-	m_blitCmd = engine::newGraphicsCommand();
+	assert(info.framesInFlight > 0);
 
-	m_imageAvailable = new Semaphore(_device.createSemaphore());
+	m_blitFrames.resize(info.framesInFlight);
 
-	m_finishedBlitting = new Semaphore(_device.createSemaphore());
+	for (BlitFrame& frame : m_blitFrames) {
+		frame.cmd = engine::newGraphicsCommand();
+		frame.inFlight = new Fence(_device.createFence());
+		frame.imageAvailable = new Semaphore(_device.createSemaphore());
+		frame.finishedBlitting = new Semaphore(_device.createSemaphore());
+	}
 
 	setCaptureMouse(info.captureMouse);
 
@@ -43,11 +53,12 @@ Window::Window(const CreateInfo& info)
 Window::~Window() {
 	_device.waitIdle();
 
-	delete m_finishedBlitting;
-
-	delete m_imageAvailable;
-
-	delete m_blitCmd;
+	for (BlitFrame& frame : m_blitFrames) {
+		delete frame.finishedBlitting;
+		delete frame.imageAvailable;
+		delete frame.inFlight;
+		delete frame.cmd;
+	}
 
 	delete m_swapchain;
 
@@ -68,34 +79,54 @@ void Window::pollEvents() {
 	m_lastMouseY = currentY;
 }
 
-void Window::swapBuffers() {
-	Image& swapchainImage = m_swapchain->acquireNextImage(m_imageAvailable);
+void Window::swapBuffers(GpuProfiler* profiler) {
+	ETNA_TRACE_SCOPE("Window::swapBuffers");
+
+	BlitFrame& frame = m_blitFrames[m_currentFrame];
+
+	if (frame.submitted) {
+		engine::waitFence(*frame.inFlight);
+		frame.inFlight->reset();
+	}
+
+	Image& swapchainImage = m_swapchain->acquireNextImage(frame.imageAvailable);
 	Image& dstImage = isMultiSampled() ? *getResolvedImage() : *getDrawImage();
 
-	m_blitCmd->begin();
+	Command& blitCmd = *frame.cmd;
 
-	m_blitCmd->transitionImageLayout(dstImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+	blitCmd.begin();
 
-	m_blitCmd->transitionImageLayout(swapchainImage,
-									 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	{
+		GpuScope scope(profiler, blitCmd, "blit");
 
-	m_blitCmd->blitImage(dstImage, swapchainImage);
+		blitCmd.transitionImageLayout(dstImage,
+									  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
 
-	m_blitCmd->transitionToOptimalLayout(swapchainImage);
+		blitCmd.transitionImageLayout(swapchainImage,
+									  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 
-	m_blitCmd->transitionToOptimalLayout(dstImage);
+		blitCmd.blitImage(dstImage, swapchainImage);
 
-	m_blitCmd->end();
+		blitCmd.transitionToOptimalLayout(swapchainImage);
+
+		blitCmd.transitionToOptimalLayout(dstImage);
+	}
+
+	blitCmd.end();
 
 	const SubmitCmdInfo blitCmdInfo{
-		.command = *m_blitCmd,
-		.waitSemaphores = {m_imageAvailable},
-		.signalSemaphores = {m_finishedBlitting},
+		.command = blitCmd,
+		.waitSemaphores = {frame.imageAvailable},
+		.signalSemaphores = {frame.finishedBlitting},
 	};
 
-	_device.submitCommands({blitCmdInfo}, nullptr);
+	_device.submitCommands({blitCmdInfo}, frame.inFlight);
+
+	frame.submitted = true;
+
+	engine::presentCurrent(*m_swapchain, {frame.finishedBlitting});
 
-	engine::presentCurrent(*m_swapchain, {m_finishedBlitting});
+	m_currentFrame = (m_currentFrame + 1) % m_blitFrames.size();
 }
 
 bool Window::shouldClose() const {